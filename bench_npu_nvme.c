@@ -0,0 +1,1116 @@
+#include "npu_nvme.h"
+#include "checksum.h"
+#include <acl/acl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define DEFAULT_PCI_ADDR     "0000:83:00.0"
+#define DEFAULT_PIPE_DEPTH   16
+#define ITEM_SIZE            4096
+#define REGION_ITEMS         4096   /* NVMe 偏移在 16MB 区域内循环 */
+#define SCALE_CHUNK          (1024 * 1024)
+#define SCALE_TOTAL          (256ULL * 1024 * 1024)
+#define SCALE_MAX_WORKERS    8
+#define MAX_BENCH_DEVICES    16
+#define SMALL_CHUNK          (512 * 1024)
+#define SMALL_LAYERS         48
+#define COMPRESS_TOTAL       (64ULL * 1024 * 1024)
+#define CRC_ROUNDS           3
+#define POLL_CHUNK           (512 * 1024)
+#define PINNED_TOTAL         (64ULL * 1024 * 1024)
+#define NUMA_MAX_NODES       64
+#define ZERO_TOTAL           (256ULL * 1024 * 1024)
+#define CACHE_TOTAL          (128ULL * 1024 * 1024)
+#define SPACE_CKPT           (64ULL * 1024 * 1024)
+#define SPACE_ROUNDS         6
+
+typedef struct {
+    const char *nvme_addr;
+    int npu_device_id;
+    int pipeline_depth;
+} bench_cfg_t;
+
+static double now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s <mode> [pci_addr] [npu_device_id] [pipeline_depth]\n"
+            "Modes:\n"
+            "  reap     per-item batch overhead as num_items grows (4KB items)\n"
+            "  plan     per-item overhead of write/read_batch vs a reused plan (4KB items)\n"
+            "  small    transformer-like layout: many few-KB tensors between 512KB chunks\n"
+            "  compress raw vs LZ4+byte-shuffle plan on bf16-like weights (1MB chunks)\n"
+            "  crc      plan write/read with and without per-item CRC32C (1MB chunks)\n"
+            "  workers  write/read bandwidth with 1..8 qpair workers (1MB chunks)\n"
+            "  stripe   write/read bandwidth striped over the first 1..N devices of a\n"
+            "           comma-separated pci_addr list (1MB chunks, 1MB stripe unit)\n"
+            "  poll     bandwidth and CPU seconds per GB with spin / sleep / adaptive\n"
+            "           completion polling (512KB chunks)\n"
+            "  pinned   mean per-chunk D2H/H2D copy time for each DMA slab allocation\n"
+            "           policy at 64KB..4MB chunks\n"
+            "  numa     write/read bandwidth with the DMA slab and worker threads placed on\n"
+            "           the controller's NUMA node vs every other node (1MB chunks, 2 workers)\n"
+            "  zero     plan write/read with and without zero-chunk detection as the\n"
+            "           all-zero fraction grows (1MB chunks)\n"
+            "  cache    write then roll back (read) 128MB with and without a host-RAM\n"
+            "           restore cache large enough to hold it (1MB chunks)\n"
+            "  space    two tenants alternately save 64MB checkpoints through the extent\n"
+            "           allocator, keeping 2 versions each in room for 6 (1MB chunks)\n",
+            prog);
+}
+
+/* 每个 item 4KB，测量 write/read_batch 的单 item 开销随 num_items 的变化。
+ * 回收代价与 num_items 无关时，us/item 应保持平坦。 */
+static int bench_reap(const bench_cfg_t *cfg) {
+    static const int counts[] = { 1000, 10000, 100000, 1000000 };
+    const int max_items = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    int ret = 0;
+
+    npu_nvme_context_t *ctx = NULL;
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      ITEM_SIZE, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        return 1;
+    }
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, (size_t)REGION_ITEMS * ITEM_SIZE,
+                    ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        npu_nvme_cleanup(ctx);
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * max_items);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * max_items);
+    size_t *sizes = malloc(sizeof(size_t) * max_items);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < max_items; ++i) {
+        int slot = i % REGION_ITEMS;
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)slot * ITEM_SIZE;
+        offsets[i] = (uint64_t)slot * ITEM_SIZE;
+        sizes[i] = ITEM_SIZE;
+    }
+
+    printf("%-10s %12s %12s %12s %12s\n",
+           "num_items", "write_ms", "write_us/it", "read_ms", "read_us/it");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        int n = counts[c];
+        double t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, n);
+        double t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, n);
+        double t2 = now_ms();
+        if (rc != 0) {
+            fprintf(stderr, "[Reap] batch failed at num_items=%d\n", n);
+            ret = 1;
+            break;
+        }
+        printf("%-10d %12.2f %12.3f %12.2f %12.3f\n", n,
+               t1 - t0, (t1 - t0) * 1000.0 / n,
+               t2 - t1, (t2 - t1) * 1000.0 / n);
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    npu_nvme_cleanup(ctx);
+    return ret;
+}
+
+/* 同一布局重复执行：每次 write/read_batch 重新切分与分配 vs 预先创建的计划 */
+static int bench_plan(const bench_cfg_t *cfg) {
+    static const int counts[] = { 1000, 10000, 100000 };
+    const int max_items = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    const int rounds = 5;
+    int ret = 0;
+
+    npu_nvme_context_t *ctx = NULL;
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      ITEM_SIZE, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        return 1;
+    }
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, (size_t)REGION_ITEMS * ITEM_SIZE,
+                    ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        npu_nvme_cleanup(ctx);
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * max_items);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * max_items);
+    size_t *sizes = malloc(sizeof(size_t) * max_items);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < max_items; ++i) {
+        int slot = i % REGION_ITEMS;
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)slot * ITEM_SIZE;
+        offsets[i] = (uint64_t)slot * ITEM_SIZE;
+        sizes[i] = ITEM_SIZE;
+    }
+
+    printf("%-10s %14s %14s %14s %14s\n", "num_items",
+           "batch_w_us/it", "plan_w_us/it", "batch_r_us/it", "plan_r_us/it");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        int n = counts[c];
+        npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, ptrs, offsets, sizes, n);
+        if (!plan) {
+            fprintf(stderr, "[Plan] plan_create failed at num_items=%d\n", n);
+            ret = 1;
+            break;
+        }
+        double tw[2] = { 0 }, tr[2] = { 0 };
+        int rc = 0;
+        for (int r = 0; r < rounds && rc == 0; ++r) {
+            double t0 = now_ms();
+            rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, n);
+            double t1 = now_ms();
+            if (rc == 0) rc = npu_nvme_plan_execute_write(plan);
+            double t2 = now_ms();
+            if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, n);
+            double t3 = now_ms();
+            if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+            double t4 = now_ms();
+            tw[0] += t1 - t0;
+            tw[1] += t2 - t1;
+            tr[0] += t3 - t2;
+            tr[1] += t4 - t3;
+        }
+        npu_nvme_plan_destroy(plan);
+        if (rc != 0) {
+            fprintf(stderr, "[Plan] batch failed at num_items=%d\n", n);
+            ret = 1;
+            break;
+        }
+        double k = 1000.0 / ((double)n * rounds);
+        printf("%-10d %14.3f %14.3f %14.3f %14.3f\n", n,
+               tw[0] * k, tw[1] * k, tr[0] * k, tr[1] * k);
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    npu_nvme_cleanup(ctx);
+    return ret;
+}
+
+/* 类 transformer 布局：每层 2 个 512KB 大块 + 8 个几 KB 的 LayerNorm/bias 小张量，
+ * 按 Python 端的方式在 NVMe 上 4K 对齐紧密排列，NPU 上按实际大小紧密排列 */
+static int bench_small(const bench_cfg_t *cfg) {
+    const int per_layer = 10;
+    const int num = SMALL_LAYERS * per_layer;
+    int ret = 0;
+
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    void *npu_buf = NULL;
+    npu_nvme_context_t *ctx = NULL;
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    size_t npu_total = 0;
+    uint64_t off = 0;
+    int small = 0;
+    for (int i = 0; i < num; ++i) {
+        int k = i % per_layer;
+        sizes[i] = (k < 2) ? SMALL_CHUNK : (size_t)(1600 + (i * 977) % 6400);
+        if (k >= 2) small++;
+        offsets[i] = off;
+        off += (sizes[i] + 4095) & ~(uint64_t)4095;
+        npu_total += sizes[i];
+    }
+    if (aclrtMalloc(&npu_buf, npu_total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        ret = 1;
+        goto out;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + pos;
+        pos += sizes[i];
+    }
+
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      SMALL_CHUNK, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        ret = 1;
+        goto out;
+    }
+
+    const int rounds = 5;
+    double tw = 0, tr = 0;
+    for (int r = 0; r < rounds && ret == 0; ++r) {
+        double t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+        double t2 = now_ms();
+        if (rc != 0) {
+            fprintf(stderr, "[Small] batch failed\n");
+            ret = 1;
+        }
+        tw += t1 - t0;
+        tr += t2 - t1;
+    }
+    if (ret == 0) {
+        printf("items=%d (small=%d), nvme span=%.2f MB\n", num, small, off / 1024.0 / 1024.0);
+        printf("%-8s %12s %12s\n", "", "ms/batch", "us/item");
+        printf("%-8s %12.2f %12.3f\n", "write", tw / rounds, tw * 1000.0 / rounds / num);
+        printf("%-8s %12.2f %12.3f\n", "read", tr / rounds, tr * 1000.0 / rounds / num);
+    }
+
+out:
+    if (ctx) npu_nvme_cleanup(ctx);
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+/* bf16 权重：近似 N(0, 0.02) 的值截断成 bf16，指数字节高度集中，尾数字节接近随机 */
+static void fill_bf16_weights(uint16_t *dst, size_t count) {
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < count; ++i) {
+        float acc = 0.0f;
+        for (int k = 0; k < 4; ++k) {
+            seed = seed * 1664525u + 1013904223u;
+            acc += (float)(seed >> 8) / 16777216.0f - 0.5f;
+        }
+        float v = acc * 0.035f;
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        dst[i] = (uint16_t)(bits >> 16);
+    }
+}
+
+/* 同一份 bf16 数据分别用不压缩 / 压缩的计划写读，对比带宽与落盘字节数 */
+static int bench_compress(const bench_cfg_t *cfg) {
+    const int num = (int)(COMPRESS_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    uint16_t *host = malloc(COMPRESS_TOTAL);
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    int *elems = malloc(sizeof(int) * num);
+    npu_nvme_context_t *ctx = NULL;
+    if (!host || !ptrs || !offsets || !sizes || !elems ||
+        aclrtMalloc(&npu_buf, COMPRESS_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to alloc buffers\n");
+        ret = 1;
+        goto out;
+    }
+    fill_bf16_weights(host, COMPRESS_TOTAL / sizeof(uint16_t));
+    if (aclrtMemcpy(npu_buf, COMPRESS_TOTAL, host, COMPRESS_TOTAL,
+                    ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS) {
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+        elems[i] = 2;
+    }
+
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      SCALE_CHUNK, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        ret = 1;
+        goto out;
+    }
+
+    printf("%-8s %12s %12s %12s\n", "codec", "stored_MB", "write_MB/s", "read_MB/s");
+    for (int codec = NPU_NVME_CODEC_NONE; codec <= NPU_NVME_CODEC_LZ4; ++codec) {
+        npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, ptrs, offsets, sizes, num);
+        if (!plan || npu_nvme_plan_set_compression(plan, codec, elems) != 0) {
+            npu_nvme_plan_destroy(plan);
+            ret = 1;
+            break;
+        }
+        double t0 = now_ms();
+        int rc = npu_nvme_plan_execute_write(plan);
+        double t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+        double t2 = now_ms();
+        uint64_t raw = COMPRESS_TOTAL, stored = COMPRESS_TOTAL;
+        if (codec != NPU_NVME_CODEC_NONE) npu_nvme_plan_get_compress_stats(plan, &raw, &stored);
+        npu_nvme_plan_destroy(plan);
+        if (rc != 0) {
+            fprintf(stderr, "[Compress] batch failed (codec %d)\n", codec);
+            ret = 1;
+            break;
+        }
+        double mb = COMPRESS_TOTAL / 1024.0 / 1024.0;
+        printf("%-8s %12.1f %12.1f %12.1f\n", codec ? "lz4" : "none",
+               stored / 1024.0 / 1024.0, mb / ((t1 - t0) / 1000.0), mb / ((t2 - t1) / 1000.0));
+    }
+
+out:
+    if (ctx) npu_nvme_cleanup(ctx);
+    free(host);
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    free(elems);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 同一计划关 / 开 CRC32C 各跑几轮，给出校验带来的带宽损失；
+ * 另外单独测一下 CRC 本身的吞吐（硬件指令与查表） */
+static int bench_crc(const bench_cfg_t *cfg) {
+    const int num = (int)(SCALE_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(SCALE_CHUNK);
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    uint32_t *crcs = malloc(sizeof(uint32_t) * num);
+    npu_nvme_context_t *ctx = NULL;
+    npu_nvme_plan_t *plan = NULL;
+    if (!host || !ptrs || !offsets || !sizes || !crcs ||
+        aclrtMalloc(&npu_buf, SCALE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to alloc buffers\n");
+        ret = 1;
+        goto out;
+    }
+    for (size_t k = 0; k < SCALE_CHUNK; ++k) host[k] = (uint8_t)(k * 2654435761u >> 13);
+
+    double t0 = now_ms();
+    uint32_t c = 0;
+    for (int i = 0; i < 64; ++i) c = cksum_crc32c(c, host, SCALE_CHUNK);
+    double t1 = now_ms();
+    for (int i = 0; i < 16; ++i) c = cksum_crc32c_sw(c, host, SCALE_CHUNK);
+    double t2 = now_ms();
+    printf("crc32c %s: %.0f MB/s, slice-by-8: %.0f MB/s (%08x)\n\n",
+           cksum_crc32c_hw() ? "hw" : "sw", 64.0 / ((t1 - t0) / 1000.0),
+           16.0 / ((t2 - t1) / 1000.0), c);
+
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+        host[0] = (uint8_t)i;
+        if (aclrtMemcpy(ptrs[i], SCALE_CHUNK, host, SCALE_CHUNK,
+                        ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS) {
+            ret = 1;
+            goto out;
+        }
+    }
+
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      SCALE_CHUNK, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        ret = 1;
+        goto out;
+    }
+    plan = npu_nvme_plan_create(ctx, ptrs, offsets, sizes, num);
+    if (!plan) {
+        ret = 1;
+        goto out;
+    }
+
+    double bw[2][2];
+    printf("%-8s %12s %12s\n", "crc", "write_MB/s", "read_MB/s");
+    for (int on = 0; on <= 1; ++on) {
+        int rc = npu_nvme_plan_set_checksum(plan, on);
+        double tw = 0, tr = 0;
+        for (int r = 0; r < CRC_ROUNDS && rc == 0; ++r) {
+            double a = now_ms();
+            rc = npu_nvme_plan_execute_write(plan);
+            double b = now_ms();
+            /* 读时带上刚写入的校验和，比对也算在内 */
+            if (rc == 0 && on) {
+                rc = npu_nvme_plan_get_checksums(plan, crcs);
+                if (rc == 0) rc = npu_nvme_plan_set_expected_checksums(plan, crcs);
+            }
+            double b2 = now_ms();
+            if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+            double e = now_ms();
+            tw += b - a;
+            tr += e - b2;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "[CRC] batch failed (crc %d, rc %d)\n", on, rc);
+            ret = 1;
+            goto out;
+        }
+        double mb = SCALE_TOTAL / 1024.0 / 1024.0 * CRC_ROUNDS;
+        bw[on][0] = mb / (tw / 1000.0);
+        bw[on][1] = mb / (tr / 1000.0);
+        printf("%-8s %12.1f %12.1f\n", on ? "on" : "off", bw[on][0], bw[on][1]);
+    }
+    printf("\noverhead: write %.1f%%, read %.1f%%\n",
+           (1.0 - bw[1][0] / bw[0][0]) * 100.0, (1.0 - bw[1][1] / bw[0][1]) * 100.0);
+
+out:
+    npu_nvme_plan_destroy(plan);
+    if (ctx) npu_nvme_cleanup(ctx);
+    free(host);
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    free(crcs);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 固定 256MB、1MB chunk，worker 数 1/2/4/8，观察带宽随 qpair 数的扩展 */
+static int bench_workers(const bench_cfg_t *cfg) {
+    const int num = (int)(SCALE_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, SCALE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    printf("%-8s %12s %12s\n", "workers", "write_MB/s", "read_MB/s");
+    for (int nw = 1; nw <= SCALE_MAX_WORKERS; nw *= 2) {
+        npu_nvme_context_t *ctx = NULL;
+        if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                          SCALE_CHUNK, nw, false)) {
+            fprintf(stderr, "Initialization failed (workers=%d)\n", nw);
+            ret = 1;
+            break;
+        }
+        double t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+        double t2 = now_ms();
+        npu_nvme_cleanup(ctx);
+        if (rc != 0) {
+            fprintf(stderr, "[Workers] batch failed at workers=%d\n", nw);
+            ret = 1;
+            break;
+        }
+        double mb = SCALE_TOTAL / 1024.0 / 1024.0;
+        printf("%-8d %12.1f %12.1f\n", nw, mb / ((t1 - t0) / 1000.0),
+               mb / ((t2 - t1) / 1000.0));
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 256MB、1MB chunk，依次条带到前 1..N 个设备，观察带宽随设备数的扩展 */
+static int bench_stripe(const bench_cfg_t *cfg) {
+    const int num = (int)(SCALE_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    char addr_buf[1024];
+    const char *addrs[MAX_BENCH_DEVICES];
+    int num_devices = 0;
+    snprintf(addr_buf, sizeof(addr_buf), "%s", cfg->nvme_addr);
+    for (char *save = NULL, *tok = strtok_r(addr_buf, ",", &save);
+         tok && num_devices < MAX_BENCH_DEVICES;
+         tok = strtok_r(NULL, ",", &save)) {
+        addrs[num_devices++] = tok;
+    }
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, SCALE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    printf("%-8s %12s %12s\n", "devices", "write_MB/s", "read_MB/s");
+    for (int nd = 1; nd <= num_devices; ++nd) {
+        npu_nvme_context_t *ctx = NULL;
+        if (npu_nvme_init_striped(&ctx, addrs, nd, SCALE_CHUNK, cfg->npu_device_id,
+                                  cfg->pipeline_depth, SCALE_CHUNK, 1, false)) {
+            fprintf(stderr, "Initialization failed (devices=%d)\n", nd);
+            ret = 1;
+            break;
+        }
+        double t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+        double t2 = now_ms();
+        npu_nvme_cleanup(ctx);
+        if (rc != 0) {
+            fprintf(stderr, "[Stripe] batch failed at devices=%d\n", nd);
+            ret = 1;
+            break;
+        }
+        double mb = SCALE_TOTAL / 1024.0 / 1024.0;
+        printf("%-8d %12.1f %12.1f\n", nd, mb / ((t1 - t0) / 1000.0),
+               mb / ((t2 - t1) / 1000.0));
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 进程累计 CPU 时间（用户 + 内核），秒 */
+static double cpu_seconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* 256MB、512KB chunk，三种轮询方式各跑一遍写和读：带宽与每 GB 消耗的 CPU 秒数。
+ * spin 带宽应最高但 CPU/GB 最大，sleep 反之，adaptive 应接近 spin 的带宽、sleep 的 CPU */
+static int bench_poll(const bench_cfg_t *cfg) {
+    static const struct { int mode; const char *name; } modes[] = {
+        { NPU_NVME_POLL_SPIN, "spin" },
+        { NPU_NVME_POLL_SLEEP, "sleep" },
+        { NPU_NVME_POLL_ADAPTIVE, "adaptive" },
+    };
+    const int num = (int)(SCALE_TOTAL / POLL_CHUNK);
+    int ret = 0;
+
+    npu_nvme_context_t *ctx = NULL;
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      POLL_CHUNK, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        return 1;
+    }
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, SCALE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        npu_nvme_cleanup(ctx);
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * POLL_CHUNK;
+        offsets[i] = (uint64_t)i * POLL_CHUNK;
+        sizes[i] = POLL_CHUNK;
+    }
+
+    /* 预热一轮，让 adaptive 先有服务时间的估计 */
+    if (npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num) != 0) {
+        fprintf(stderr, "[Poll] warmup write failed\n");
+        ret = 1;
+        goto out;
+    }
+
+    double gb = SCALE_TOTAL / 1024.0 / 1024.0 / 1024.0;
+    printf("%-9s %12s %12s %12s %12s\n", "mode", "write_MB/s", "write_cpu/GB",
+           "read_MB/s", "read_cpu/GB");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        npu_nvme_set_poll_mode(ctx, modes[m].mode);
+        double c0 = cpu_seconds(), t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double c1 = cpu_seconds(), t1 = now_ms();
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+        double c2 = cpu_seconds(), t2 = now_ms();
+        if (rc != 0) {
+            fprintf(stderr, "[Poll] batch failed in %s mode\n", modes[m].name);
+            ret = 1;
+            break;
+        }
+        printf("%-9s %12.1f %12.3f %12.1f %12.3f\n", modes[m].name,
+               gb * 1024.0 / ((t1 - t0) / 1000.0), (c1 - c0) / gb,
+               gb * 1024.0 / ((t2 - t1) / 1000.0), (c2 - c1) / gb);
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    npu_nvme_cleanup(ctx);
+    return ret;
+}
+
+/* 64MB，每种 DMA slab 分配方式 x 每种 chunk 各建一个 context 写一遍读一遍，
+ * 从 copy 阶段直方图取每条命令的平均拷贝时间：写为 D2H、读为 H2D。
+ * 未向 ACL 注册的 slab 每个 chunk 多一次暂存拷贝，chunk 越大差距越明显 */
+static int bench_pinned(const bench_cfg_t *cfg) {
+    static const struct { int policy; const char *name; } policies[] = {
+        { NPU_NVME_DMA_PAGEABLE, "pageable" },
+        { NPU_NVME_DMA_SPDK_REGISTERED, "spdk+reg" },
+        { NPU_NVME_DMA_ACL_HOST, "acl-host" },
+    };
+    static const size_t chunks[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    const int max_num = (int)(PINNED_TOTAL / chunks[0]);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, PINNED_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * max_num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * max_num);
+    size_t *sizes = malloc(sizeof(size_t) * max_num);
+    npu_nvme_stats_t *st = malloc(sizeof(*st));
+    if (!ptrs || !offsets || !sizes || !st) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+
+    printf("%-9s %8s %14s %14s %12s %12s\n", "policy", "chunk_KB", "d2h_us/chunk",
+           "h2d_us/chunk", "write_MB/s", "read_MB/s");
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && ret == 0; ++p) {
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+            const int num = (int)(PINNED_TOTAL / chunks[c]);
+            for (int i = 0; i < num; ++i) {
+                ptrs[i] = (uint8_t *)npu_buf + (size_t)i * chunks[c];
+                offsets[i] = (uint64_t)i * chunks[c];
+                sizes[i] = chunks[c];
+            }
+            const char *addr = cfg->nvme_addr;
+            npu_nvme_opts_t o;
+            npu_nvme_opts_init(&o);
+            o.nvme_pci_addrs = &addr;
+            o.npu_device_id = cfg->npu_device_id;
+            o.queue_depth = cfg->pipeline_depth;
+            o.chunk_size = chunks[c];
+            o.dma_policy = policies[p].policy;
+            npu_nvme_context_t *ctx = NULL;
+            if (npu_nvme_init_opts(&ctx, &o)) {
+                fprintf(stderr, "Initialization failed (%s, chunk %zu)\n",
+                        policies[p].name, chunks[c]);
+                ret = 1;
+                break;
+            }
+            if (npu_nvme_get_dma_policy(ctx) != policies[p].policy) {
+                printf("%-9s %8zu   registration failed, skipped\n",
+                       policies[p].name, chunks[c] / 1024);
+                npu_nvme_cleanup(ctx);
+                continue;
+            }
+            npu_nvme_reset_stats(ctx);
+            double t0 = now_ms();
+            int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+            double t1 = now_ms();
+            if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+            double t2 = now_ms();
+            if (rc == 0) rc = npu_nvme_get_stats(ctx, st);
+            npu_nvme_cleanup(ctx);
+            if (rc != 0) {
+                fprintf(stderr, "[Pinned] batch failed (%s, chunk %zu)\n",
+                        policies[p].name, chunks[c]);
+                ret = 1;
+                break;
+            }
+            const npu_nvme_hist_t *wh = &st->write.hist[NPU_NVME_STAGE_COPY];
+            const npu_nvme_hist_t *rh = &st->read.hist[NPU_NVME_STAGE_COPY];
+            double mb = PINNED_TOTAL / 1024.0 / 1024.0;
+            printf("%-9s %8zu %14.1f %14.1f %12.1f %12.1f\n", policies[p].name,
+                   chunks[c] / 1024,
+                   wh->count ? wh->sum_ns / 1000.0 / wh->count : 0.0,
+                   rh->count ? rh->sum_ns / 1000.0 / rh->count : 0.0,
+                   mb / ((t1 - t0) / 1000.0), mb / ((t2 - t1) / 1000.0));
+        }
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    free(st);
+    aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 一次 256MB 读写，slab 与线程放在 numa_node 上；返回 0 成功，node_out 为实际生效的节点 */
+static int numa_run(const bench_cfg_t *cfg, int numa_node, void **ptrs, uint64_t *offsets,
+                    size_t *sizes, int num, int *node_out, double *wr_mbps, double *rd_mbps) {
+    const char *addr = cfg->nvme_addr;
+    npu_nvme_opts_t o;
+    npu_nvme_opts_init(&o);
+    o.nvme_pci_addrs = &addr;
+    o.npu_device_id = cfg->npu_device_id;
+    o.queue_depth = cfg->pipeline_depth;
+    o.chunk_size = SCALE_CHUNK;
+    o.num_workers = 2;
+    o.numa_node = numa_node;
+    npu_nvme_context_t *ctx = NULL;
+    if (npu_nvme_init_opts(&ctx, &o)) return -1;
+    *node_out = npu_nvme_get_numa_node(ctx);
+    double t0 = now_ms();
+    int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+    double t1 = now_ms();
+    if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+    double t2 = now_ms();
+    npu_nvme_cleanup(ctx);
+    double mb = SCALE_TOTAL / 1024.0 / 1024.0;
+    *wr_mbps = mb / ((t1 - t0) / 1000.0);
+    *rd_mbps = mb / ((t2 - t1) / 1000.0);
+    return rc;
+}
+
+/* 256MB、1MB chunk、2 个 worker：先按控制器所在节点自动放置，再强制放到每个节点上，
+ * 对比本地与跨 socket 放置的带宽。控制器节点未知时只列出各节点的结果 */
+static int bench_numa(const bench_cfg_t *cfg) {
+    const int num = (int)(SCALE_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    if (aclrtMalloc(&npu_buf, SCALE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate NPU buffer\n");
+        return 1;
+    }
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes) {
+        fprintf(stderr, "Failed to alloc item arrays\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    int local = -1, node;
+    double wr, rd;
+    if (numa_run(cfg, NPU_NVME_NUMA_AUTO, ptrs, offsets, sizes, num, &local, &wr, &rd) != 0) {
+        fprintf(stderr, "[NUMA] auto placement failed\n");
+        ret = 1;
+        goto out;
+    }
+    if (local < 0) printf("[NUMA] controller node unknown, forcing each node\n");
+
+    printf("%-8s %-8s %12s %12s\n", "node", "place", "write_MB/s", "read_MB/s");
+    for (int n = 0; n < NUMA_MAX_NODES; ++n) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK) != 0) continue;
+        if (numa_run(cfg, n, ptrs, offsets, sizes, num, &node, &wr, &rd) != 0) {
+            fprintf(stderr, "[NUMA] batch failed on node %d\n", n);
+            ret = 1;
+            break;
+        }
+        printf("%-8d %-8s %12.1f %12.1f\n", n,
+               local < 0 ? "-" : (n == local ? "local" : "remote"), wr, rd);
+    }
+    if (ret == 0 &&
+        numa_run(cfg, NPU_NVME_NUMA_OFF, ptrs, offsets, sizes, num, &node, &wr, &rd) == 0) {
+        printf("%-8s %-8s %12.1f %12.1f\n", "off", "any", wr, rd);
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 前 pct% 的 chunk 全零，其余为随机数据；同一份数据分别关 / 开全零检测写读一遍 */
+static int bench_zero(const bench_cfg_t *cfg) {
+    static const int pcts[] = { 0, 50, 90 };
+    const int num = (int)(ZERO_TOTAL / SCALE_CHUNK);
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(ZERO_TOTAL);
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    npu_nvme_context_t *ctx = NULL;
+    if (!host || !ptrs || !offsets || !sizes ||
+        aclrtMalloc(&npu_buf, ZERO_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to alloc buffers\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      SCALE_CHUNK, 1, false)) {
+        fprintf(stderr, "Initialization failed\n");
+        ret = 1;
+        goto out;
+    }
+
+    printf("%6s %8s %12s %12s %12s\n", "zero%", "detect", "zero_MB", "write_MB/s", "read_MB/s");
+    for (size_t p = 0; p < sizeof(pcts) / sizeof(pcts[0]) && ret == 0; ++p) {
+        size_t zero_len = (size_t)(num * pcts[p] / 100) * SCALE_CHUNK;
+        memset(host, 0, zero_len);
+        for (size_t k = zero_len; k < ZERO_TOTAL; ++k) host[k] = (uint8_t)rand();
+        if (aclrtMemcpy(npu_buf, ZERO_TOTAL, host, ZERO_TOTAL,
+                        ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS) {
+            ret = 1;
+            break;
+        }
+        for (int detect = 0; detect <= 1; ++detect) {
+            npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, ptrs, offsets, sizes, num);
+            if (!plan || npu_nvme_plan_set_zero_detect(plan, detect) != 0) {
+                npu_nvme_plan_destroy(plan);
+                ret = 1;
+                break;
+            }
+            double t0 = now_ms();
+            int rc = npu_nvme_plan_execute_write(plan);
+            double t1 = now_ms();
+            if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+            double t2 = now_ms();
+            uint64_t zero = 0;
+            if (detect) npu_nvme_plan_get_zero_stats(plan, &zero);
+            npu_nvme_plan_destroy(plan);
+            if (rc != 0) {
+                fprintf(stderr, "[Zero] batch failed (%d%%, detect %d)\n", pcts[p], detect);
+                ret = 1;
+                break;
+            }
+            double mb = ZERO_TOTAL / 1024.0 / 1024.0;
+            printf("%6d %8s %12.1f %12.1f %12.1f\n", pcts[p], detect ? "on" : "off",
+                   zero / 1024.0 / 1024.0, mb / ((t1 - t0) / 1000.0), mb / ((t2 - t1) / 1000.0));
+        }
+    }
+
+out:
+    if (ctx) npu_nvme_cleanup(ctx);
+    free(host);
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 关 / 开主机恢复缓存各 init 一次：写一遍再读回，缓存打开时读应全部命中 */
+static int bench_cache(const bench_cfg_t *cfg) {
+    const int num = (int)(CACHE_TOTAL / SCALE_CHUNK);
+    const char *addr = cfg->nvme_addr;
+    int ret = 0;
+
+    void *npu_buf = NULL;
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes ||
+        aclrtMalloc(&npu_buf, CACHE_TOTAL, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to alloc buffers\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        offsets[i] = (uint64_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    printf("%-6s %12s %12s %8s\n", "cache", "write_MB/s", "read_MB/s", "hit%");
+    for (int on = 0; on <= 1; ++on) {
+        npu_nvme_opts_t o;
+        npu_nvme_opts_init(&o);
+        o.nvme_pci_addrs = &addr;
+        o.npu_device_id = cfg->npu_device_id;
+        o.queue_depth = cfg->pipeline_depth;
+        o.chunk_size = SCALE_CHUNK;
+        o.host_cache_bytes = on ? CACHE_TOTAL : 0;
+        npu_nvme_context_t *ctx = NULL;
+        if (npu_nvme_init_opts(&ctx, &o)) {
+            fprintf(stderr, "Initialization failed\n");
+            ret = 1;
+            break;
+        }
+        npu_nvme_stats_t st;
+        double t0 = now_ms();
+        int rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double t1 = now_ms();
+        npu_nvme_reset_stats(ctx);
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, ptrs, offsets, sizes, num);
+        double t2 = now_ms();
+        if (rc == 0) rc = npu_nvme_get_stats(ctx, &st);
+        npu_nvme_cleanup(ctx);
+        if (rc != 0) {
+            fprintf(stderr, "[Cache] batch failed (cache %s)\n", on ? "on" : "off");
+            ret = 1;
+            break;
+        }
+        double mb = CACHE_TOTAL / 1024.0 / 1024.0;
+        printf("%-6s %12.1f %12.1f %8.1f\n", on ? "on" : "off",
+               mb / ((t1 - t0) / 1000.0), mb / ((t2 - t1) / 1000.0),
+               st.read.commands ? 100.0 * st.read.cache_hits / st.read.commands : 0.0);
+    }
+
+out:
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+/* 两个 tenant 轮流保存，各保留 2 个版本，空间只够 6 个 checkpoint：
+ * 每轮的分配 + 提交 + 保留（元数据落盘）开销与写本身对比，旧版本在后台回收后被复用 */
+static int bench_space(const bench_cfg_t *cfg) {
+    const int num = (int)(SPACE_CKPT / SCALE_CHUNK);
+    const char *tenants[2] = { "model_a", "model_b" };
+    int ret = 0;
+
+    npu_nvme_context_t *ctx = NULL;
+    npu_nvme_space_t *sp = NULL;
+    void *npu_buf = NULL;
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    if (!ptrs || !offsets || !sizes ||
+        aclrtMalloc(&npu_buf, SPACE_CKPT, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        fprintf(stderr, "Failed to alloc buffers\n");
+        ret = 1;
+        goto out;
+    }
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * SCALE_CHUNK;
+        sizes[i] = SCALE_CHUNK;
+    }
+
+    if (npu_nvme_init(&ctx, cfg->nvme_addr, cfg->npu_device_id, cfg->pipeline_depth,
+                      SCALE_CHUNK, 1, false) ||
+        npu_nvme_space_open(ctx, 0, NPU_NVME_SPACE_META_BYTES + 6 * SPACE_CKPT, 0, &sp) != 0) {
+        fprintf(stderr, "Initialization failed\n");
+        ret = 1;
+        goto out;
+    }
+
+    printf("%-8s %8s %10s %12s %10s %10s %14s\n", "tenant", "version", "offset_MB",
+           "write_MB/s", "alloc_ms", "commit_ms", "reclaiming_MB");
+    for (int r = 0; r < 2 * SPACE_ROUNDS && ret == 0; ++r) {
+        const char *t = tenants[r % 2];
+        npu_nvme_extent_t e;
+        npu_nvme_space_stats_t st;
+        double t0 = now_ms();
+        int rc = npu_nvme_space_alloc(sp, t, SPACE_CKPT, &e);
+        double t1 = now_ms();
+        for (int i = 0; rc == 0 && i < num; ++i) offsets[i] = e.offset + (uint64_t)i * SCALE_CHUNK;
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, ptrs, offsets, sizes, num);
+        double t2 = now_ms();
+        if (rc == 0) rc = npu_nvme_space_commit(sp, t, e.version);
+        if (rc == 0 && npu_nvme_space_retain(sp, t, 2) < 0) rc = -1;
+        double t3 = now_ms();
+        if (rc == 0) rc = npu_nvme_space_get_stats(sp, &st);
+        if (rc != 0) {
+            fprintf(stderr, "[Space] round %d failed (%d)\n", r, rc);
+            ret = 1;
+            break;
+        }
+        printf("%-8s %8lu %10.1f %12.1f %10.2f %10.2f %14.1f\n", t, e.version,
+               e.offset / 1024.0 / 1024.0, SPACE_CKPT / 1024.0 / 1024.0 / ((t2 - t1) / 1000.0),
+               t1 - t0, t3 - t2, st.reclaiming_bytes / 1024.0 / 1024.0);
+    }
+
+out:
+    npu_nvme_space_close(sp);
+    if (ctx) npu_nvme_cleanup(ctx);
+    free(ptrs);
+    free(offsets);
+    free(sizes);
+    if (npu_buf) aclrtFree(npu_buf);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *mode = argv[1];
+    bench_cfg_t cfg = {
+        .nvme_addr = (argc > 2) ? argv[2] : DEFAULT_PCI_ADDR,
+        .npu_device_id = (argc > 3) ? atoi(argv[3]) : 0,
+        .pipeline_depth = (argc > 4) ? atoi(argv[4]) : DEFAULT_PIPE_DEPTH,
+    };
+
+    printf("======================================\n");
+    printf("NPU-NVMe Benchmark: %s\n", mode);
+    printf("PCIe addr      : %s\n", cfg.nvme_addr);
+    printf("pipeline depth : %d\n", cfg.pipeline_depth);
+    printf("======================================\n\n");
+
+    if (strcmp(mode, "reap") == 0) return bench_reap(&cfg);
+    if (strcmp(mode, "compress") == 0) return bench_compress(&cfg);
+    if (strcmp(mode, "crc") == 0) return bench_crc(&cfg);
+    if (strcmp(mode, "small") == 0) return bench_small(&cfg);
+    if (strcmp(mode, "plan") == 0) return bench_plan(&cfg);
+    if (strcmp(mode, "workers") == 0) return bench_workers(&cfg);
+    if (strcmp(mode, "stripe") == 0) return bench_stripe(&cfg);
+    if (strcmp(mode, "poll") == 0) return bench_poll(&cfg);
+    if (strcmp(mode, "pinned") == 0) return bench_pinned(&cfg);
+    if (strcmp(mode, "numa") == 0) return bench_numa(&cfg);
+    if (strcmp(mode, "zero") == 0) return bench_zero(&cfg);
+    if (strcmp(mode, "cache") == 0) return bench_cache(&cfg);
+    if (strcmp(mode, "space") == 0) return bench_space(&cfg);
+    usage(argv[0]);
+    return 1;
+}
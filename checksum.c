@@ -0,0 +1,297 @@
+#include "checksum.h"
+#include <string.h>
+
+/* =========================
+ * XXH64（与参考实现输出一致，按小端读取）
+ * ========================= */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+uint64_t cksum_xxh64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_P1 + XXH_P2;
+        uint64_t v2 = seed + XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_P1;
+        const uint8_t *limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_P5;
+    }
+
+    h += (uint64_t)len;
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (uint64_t)(*p) * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* =========================
+ * CRC32C（Castagnoli，反射多项式 0x82F63B78）
+ * x86 用 SSE4.2 crc32 指令，aarch64 用 ARMv8 CRC 指令（运行时检测），
+ * 否则 slice-by-8 查表。大块拆成三路交错计算再合并，掩盖指令延迟。
+ * ========================= */
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC_HW_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define CRC_HW_ARM 1
+#endif
+#include <pthread.h>
+
+#define CRC32C_POLY     0x82f63b78u
+#define CRC_LANE_MIN    4096    /* 小于 3 * 该值时不拆三路 */
+
+static uint32_t crc_table[8][256];
+static uint32_t crc_x2n[32];    /* x^(2^n) mod P */
+static int crc_hw;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* a * b mod P（反射表示，x^0 为最高位） */
+static uint32_t crc_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(n * 2^k) mod P */
+static uint32_t crc_x2nmodp(uint64_t n, unsigned k) {
+    uint32_t p = 1u << 31;
+    while (n) {
+        if (n & 1) p = crc_multmodp(crc_x2n[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+
+    uint32_t p = 1u << 30;      /* x^1 */
+    crc_x2n[0] = p;
+    for (int n = 1; n < 32; n++) crc_x2n[n] = p = crc_multmodp(p, p);
+
+#if defined(CRC_HW_X86)
+    __builtin_cpu_init();
+    crc_hw = __builtin_cpu_supports("sse4.2") != 0;
+#elif defined(CRC_HW_ARM)
+    crc_hw = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+/* 以下各实现的 crc 参数 / 返回值均为未取反的寄存器值 */
+static uint32_t crc_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v = read64(p) ^ crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+              crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+              crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+              crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(CRC_HW_X86)
+#define CRC_HW_ATTR __attribute__((target("sse4.2")))
+#define CRC_U8(c, v)  _mm_crc32_u8((c), (v))
+#define CRC_U64(c, v) ((uint32_t)_mm_crc32_u64((c), (v)))
+#elif defined(CRC_HW_ARM)
+#if defined(__clang__)
+#define CRC_HW_ATTR __attribute__((target("crc")))
+#else
+#define CRC_HW_ATTR __attribute__((target("+crc")))
+#endif
+#define CRC_U8(c, v)  __crc32cb((c), (v))
+#define CRC_U64(c, v) __crc32cd((c), (v))
+#endif
+
+#ifdef CRC_HW_ATTR
+CRC_HW_ATTR static uint32_t crc_hw_run(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = CRC_U8(crc, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8) crc = CRC_U64(crc, read64(p));
+    while (len--) crc = CRC_U8(crc, *p++);
+    return crc;
+}
+
+CRC_HW_ATTR static uint32_t crc_hw_update(uint32_t crc, const uint8_t *p, size_t len) {
+    if (len >= 3 * CRC_LANE_MIN) {
+        /* 三段独立计算，再用 x^(8n) 把前两段移位合并 */
+        size_t n = (len / 3) & ~(size_t)7;
+        const uint8_t *p1 = p + n, *p2 = p + 2 * n;
+        uint32_t c0 = crc, c1 = 0xffffffffu, c2 = 0xffffffffu;
+        for (size_t i = 0; i < n; i += 8) {
+            c0 = CRC_U64(c0, read64(p + i));
+            c1 = CRC_U64(c1, read64(p1 + i));
+            c2 = CRC_U64(c2, read64(p2 + i));
+        }
+        uint32_t shift = crc_x2nmodp(n, 3);
+        crc = ~(crc_multmodp(shift, ~c0) ^ ~c1);
+        crc = ~(crc_multmodp(shift, ~crc) ^ ~c2);
+        p += 3 * n;
+        len -= 3 * n;
+    }
+    return crc_hw_run(crc, p, len);
+}
+#endif
+
+uint32_t cksum_crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    const uint8_t *p = data;
+    crc = ~crc;
+#ifdef CRC_HW_ATTR
+    if (crc_hw) return ~crc_hw_update(crc, p, len);
+#endif
+    return ~crc_sw(crc, p, len);
+}
+
+uint32_t cksum_crc32c_sw(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    return ~crc_sw(~crc, data, len);
+}
+
+uint32_t cksum_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    pthread_once(&crc_once, crc_init);
+    return crc_multmodp(crc_x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+int cksum_crc32c_hw(void) {
+    pthread_once(&crc_once, crc_init);
+    return crc_hw;
+}
+
+uint32_t cksum_crc32c_zeros(uint32_t crc, uint64_t len) {
+    pthread_once(&crc_once, crc_init);
+    /* 寄存器经过 len 个 0 字节即乘以 x^(8 len) */
+    return ~crc_multmodp(crc_x2nmodp(len, 3), ~crc);
+}
+
+/* =========================
+ * 全零检测：x86 用 SSE2，aarch64 用 NEON（都是基线指令集，无需运行时检测），
+ * 每 64 字节 OR 归约一次，非零数据通常在第一组就返回
+ * ========================= */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ZERO_NEON 1
+#endif
+
+int cksum_is_zero(const void *data, size_t len) {
+    const uint8_t *p = data;
+#if defined(__SSE2__)
+    const __m128i z = _mm_setzero_si128();
+    for (; len >= 64; p += 64, len -= 64) {
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *)p),
+                                              _mm_loadu_si128((const __m128i *)(p + 16))),
+                                 _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + 32)),
+                                              _mm_loadu_si128((const __m128i *)(p + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, z)) != 0xffff) return 0;
+    }
+#elif defined(ZERO_NEON)
+    for (; len >= 64; p += 64, len -= 64) {
+        uint8x16_t v = vorrq_u8(vorrq_u8(vld1q_u8(p), vld1q_u8(p + 16)),
+                                vorrq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48)));
+        if (vmaxvq_u8(v)) return 0;
+    }
+#endif
+    for (; len >= 8; p += 8, len -= 8) {
+        if (read64(p)) return 0;
+    }
+    while (len--) {
+        if (*p++) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef NPU_NVME_CHECKSUM_H
+#define NPU_NVME_CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* XXH64：增量 checkpoint 的块指纹，seed 可用于把多段数据串联成一个指纹 */
+uint64_t cksum_xxh64(const void *data, size_t len, uint64_t seed);
+
+/* CRC32C：数据完整性校验，crc 传入上一段的结果可续算（首段传 0） */
+uint32_t cksum_crc32c(uint32_t crc, const void *data, size_t len);
+/* 强制走查表实现（测试 / bench 对比用） */
+uint32_t cksum_crc32c_sw(uint32_t crc, const void *data, size_t len);
+/* 已知 crc(A)、crc(B) 与 len(B)，求 crc(A||B) */
+uint32_t cksum_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+/* 是否使用了硬件 CRC 指令 */
+int cksum_crc32c_hw(void);
+/* 续算 len 个 0 字节的 CRC32C，不必真的扫描，等价于 cksum_crc32c(crc, zeros, len) */
+uint32_t cksum_crc32c_zeros(uint32_t crc, uint64_t len);
+
+/* 数据是否全零：SIMD 按 64 字节一组 OR 归约，遇到非零立即返回 */
+int cksum_is_zero(const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,251 @@
+#include "compress.h"
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* =========================
+ * LZ4 block 格式（贪心匹配，单哈希表）
+ * ========================= */
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5      /* 最后 5 字节必须是字面量 */
+#define LZ4_MFLIMIT       12     /* 最后一个匹配至少在结尾前 12 字节开始 */
+#define LZ4_HASH_LOG      14
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_SKIP_SHIFT    6
+
+static inline uint32_t read_u32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+size_t cz_lz4_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* 写 token 之外的长度扩展字节 */
+static inline uint8_t *put_len(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* 一个序列：字面量 [anchor, ip) + 匹配 (offset, mlen)；mlen 为 0 表示最后一段 */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *anchor, size_t lit,
+                             uint16_t offset, size_t mlen) {
+    uint8_t *token = op++;
+    size_t ml = mlen ? mlen - LZ4_MIN_MATCH : 0;
+    *token = (uint8_t)(((lit >= 15) ? 15 : lit) << 4);
+    if (lit >= 15) op = put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    if (!mlen) return op;
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)((ml >= 15) ? 15 : ml);
+    if (ml >= 15) op = put_len(op, ml - 15);
+    return op;
+}
+
+size_t cz_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint32_t table[1 << LZ4_HASH_LOG];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + n;
+    const uint8_t *mflimit = (n > LZ4_MFLIMIT) ? end - LZ4_MFLIMIT : src;
+    const uint8_t *match_end = end - LZ4_LAST_LITERALS;
+    uint8_t *op = dst;
+    uint8_t *op_end = dst + cap;
+
+    /* cap 可以小于 cz_lz4_bound：每个序列写出前按最坏长度检查，装不下直接放弃 */
+    memset(table, 0, sizeof(table));
+
+    if (n > LZ4_MFLIMIT) {
+        uint32_t misses = 0;
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = read_u32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read_u32(ref) != seq) {
+                /* 连续找不到匹配时加大步长，不可压缩的数据很快扫过去 */
+                ip += 1 + (misses++ >> LZ4_SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+
+            /* 向前扩展匹配 */
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + LZ4_MIN_MATCH;
+            const uint8_t *rp = ref + LZ4_MIN_MATCH;
+            while (mp < match_end && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            size_t lit = (size_t)(ip - anchor);
+            size_t mlen = (size_t)(mp - ip);
+            if ((size_t)(op_end - op) < 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1) return 0;
+            op = put_sequence(op, anchor, lit, (uint16_t)(ip - ref), mlen);
+
+            ip = mp;
+            anchor = ip;
+            if (ip < mflimit) table[lz4_hash(read_u32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    size_t lit = (size_t)(end - anchor);
+    if ((size_t)(op_end - op) < 1 + lit + lit / 255 + 1) return 0;
+    op = put_sequence(op, anchor, lit, 0, 0);
+    return (size_t)(op - dst);
+}
+
+int cz_lz4_decompress(const uint8_t *src, size_t clen, uint8_t *dst, size_t n) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + clen;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + n;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break;       /* 最后一段只有字面量 */
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < mlen) return -1;
+        const uint8_t *ref = op - offset;
+        /* 匹配可能与输出重叠（offset < mlen），逐字节拷贝 */
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *ref++;
+        }
+    }
+    return (op == oend) ? 0 : -1;
+}
+
+/* =========================
+ * byte shuffle
+ * ========================= */
+void cz_shuffle(const uint8_t *src, uint8_t *dst, size_t n, int elem) {
+    if (elem <= 1) {
+        memcpy(dst, src, n);
+        return;
+    }
+    size_t cnt = n / elem;
+    size_t i = 0;
+#if defined(__aarch64__)
+    if (elem == 2) {
+        for (; i + 16 <= cnt; i += 16) {
+            uint8x16x2_t v = vld2q_u8(src + i * 2);
+            vst1q_u8(dst + i, v.val[0]);
+            vst1q_u8(dst + cnt + i, v.val[1]);
+        }
+    } else if (elem == 4) {
+        for (; i + 16 <= cnt; i += 16) {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            vst1q_u8(dst + i, v.val[0]);
+            vst1q_u8(dst + cnt + i, v.val[1]);
+            vst1q_u8(dst + 2 * cnt + i, v.val[2]);
+            vst1q_u8(dst + 3 * cnt + i, v.val[3]);
+        }
+    }
+#elif defined(__SSE2__)
+    if (elem == 2) {
+        const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+        for (; i + 16 <= cnt; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i * 2));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+            __m128i lo = _mm_packus_epi16(_mm_and_si128(a, lo_mask), _mm_and_si128(b, lo_mask));
+            __m128i hi = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i *)(dst + i), lo);
+            _mm_storeu_si128((__m128i *)(dst + cnt + i), hi);
+        }
+    }
+#endif
+    for (; i < cnt; ++i) {
+        for (int k = 0; k < elem; ++k) dst[(size_t)k * cnt + i] = src[i * elem + k];
+    }
+    memcpy(dst + cnt * elem, src + cnt * elem, n - cnt * elem);
+}
+
+void cz_unshuffle(const uint8_t *src, uint8_t *dst, size_t n, int elem) {
+    if (elem <= 1) {
+        memcpy(dst, src, n);
+        return;
+    }
+    size_t cnt = n / elem;
+    size_t i = 0;
+#if defined(__aarch64__)
+    if (elem == 2) {
+        for (; i + 16 <= cnt; i += 16) {
+            uint8x16x2_t v;
+            v.val[0] = vld1q_u8(src + i);
+            v.val[1] = vld1q_u8(src + cnt + i);
+            vst2q_u8(dst + i * 2, v);
+        }
+    } else if (elem == 4) {
+        for (; i + 16 <= cnt; i += 16) {
+            uint8x16x4_t v;
+            v.val[0] = vld1q_u8(src + i);
+            v.val[1] = vld1q_u8(src + cnt + i);
+            v.val[2] = vld1q_u8(src + 2 * cnt + i);
+            v.val[3] = vld1q_u8(src + 3 * cnt + i);
+            vst4q_u8(dst + i * 4, v);
+        }
+    }
+#elif defined(__SSE2__)
+    if (elem == 2) {
+        for (; i + 16 <= cnt; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(src + cnt + i));
+            _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(lo, hi));
+            _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(lo, hi));
+        }
+    }
+#endif
+    for (; i < cnt; ++i) {
+        for (int k = 0; k < elem; ++k) dst[i * elem + k] = src[(size_t)k * cnt + i];
+    }
+    memcpy(dst + cnt * elem, src + cnt * elem, n - cnt * elem);
+}
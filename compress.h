@@ -0,0 +1,28 @@
+#ifndef NPU_NVME_COMPRESS_H
+#define NPU_NVME_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* LZ4 block 格式压缩输出的最坏长度 */
+size_t cz_lz4_bound(size_t n);
+
+/* 压缩 src[0, n) 到 dst，返回压缩后长度；dst 容量 cap 不够时返回 0 */
+size_t cz_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+/* 解压到 dst，输出长度必须恰好为 n；返回 0 成功，-1 数据损坏 */
+int cz_lz4_decompress(const uint8_t *src, size_t clen, uint8_t *dst, size_t n);
+
+/* 按元素大小 elem 把字节拆成平面（第 k 个平面为每个元素的第 k 个字节），
+ * 浮点数的指数字节因此聚在一起；n 不是 elem 整数倍时尾部原样拷贝 */
+void cz_shuffle(const uint8_t *src, uint8_t *dst, size_t n, int elem);
+void cz_unshuffle(const uint8_t *src, uint8_t *dst, size_t n, int elem);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,6 +1,9 @@
+import asyncio
 import ctypes
 import math
+import os
 import time
+import zlib
 from typing import List, Dict
 
 import torch
@@ -14,15 +17,71 @@ lib = ctypes.CDLL("./out/lib/libnpu_nvme.so")
 class NPUNVMEContext(ctypes.Structure):
     pass
 
-# init(ctx**, addr, pipeline_depth, requested_chunk_size)
+# init(ctx**, addr, npu_device_id, pipeline_depth, requested_chunk_size, num_workers, enable_profiling)
 lib.npu_nvme_init.argtypes = [
     ctypes.POINTER(ctypes.POINTER(NPUNVMEContext)),
     ctypes.c_char_p,
     ctypes.c_int,
+    ctypes.c_int,
     ctypes.c_size_t,
+    ctypes.c_int,
+    ctypes.c_bool,
 ]
 lib.npu_nvme_init.restype = ctypes.c_int
 
+# init_striped(ctx**, addrs, num_devices, stripe_unit, npu_device_id, pipeline_depth,
+#              requested_chunk_size, num_workers, enable_profiling)
+lib.npu_nvme_init_striped.argtypes = [
+    ctypes.POINTER(ctypes.POINTER(NPUNVMEContext)),
+    ctypes.POINTER(ctypes.c_char_p),
+    ctypes.c_int,
+    ctypes.c_size_t,
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.c_size_t,
+    ctypes.c_int,
+    ctypes.c_bool,
+]
+lib.npu_nvme_init_striped.restype = ctypes.c_int
+
+# init_opts(ctx**, opts*)：queue_depth 与 DMA 内存分开配置
+class NPUNVMEOpts(ctypes.Structure):
+    _fields_ = [
+        ("nvme_pci_addrs", ctypes.POINTER(ctypes.c_char_p)),
+        ("num_devices", ctypes.c_int),
+        ("stripe_unit", ctypes.c_size_t),
+        ("npu_device_id", ctypes.c_int),
+        ("queue_depth", ctypes.c_int),
+        ("chunk_size", ctypes.c_size_t),
+        ("dma_mem_bytes", ctypes.c_size_t),
+        ("num_workers", ctypes.c_int),
+        ("enable_profiling", ctypes.c_bool),
+        ("poll_mode", ctypes.c_int),
+        ("shm_id", ctypes.c_int),
+        ("dma_policy", ctypes.c_int),
+        ("numa_node", ctypes.c_int),
+        ("npu_pci_addr", ctypes.c_char_p),
+        ("host_cache_bytes", ctypes.c_size_t),
+    ]
+
+# 只剩 NVMe 命令在途时的等待方式，与 npu_nvme_poll_mode_t 对应
+POLL_MODES = {"adaptive": 0, "spin": 1, "sleep": 2}
+
+# DMA slab 的分配方式，与 npu_nvme_dma_policy_t 对应
+DMA_POLICIES = {"spdk_registered": 0, "acl_host": 1, "pageable": 2}
+
+# numa_node 的特殊值，与 NPU_NVME_NUMA_AUTO / NPU_NVME_NUMA_OFF 对应
+NUMA_AUTO = -1
+NUMA_OFF = -2
+
+lib.npu_nvme_opts_init.argtypes = [ctypes.POINTER(NPUNVMEOpts)]
+lib.npu_nvme_opts_init.restype = None
+lib.npu_nvme_init_opts.argtypes = [
+    ctypes.POINTER(ctypes.POINTER(NPUNVMEContext)),
+    ctypes.POINTER(NPUNVMEOpts),
+]
+lib.npu_nvme_init_opts.restype = ctypes.c_int
+
 # cleanup
 lib.npu_nvme_cleanup.argtypes = [ctypes.POINTER(NPUNVMEContext)]
 lib.npu_nvme_cleanup.restype = None
@@ -31,6 +90,98 @@ lib.npu_nvme_cleanup.restype = None
 lib.npu_nvme_get_max_transfer.argtypes = [ctypes.POINTER(NPUNVMEContext)]
 lib.npu_nvme_get_max_transfer.restype = ctypes.c_size_t
 
+class NPUNVMETune(ctypes.Structure):
+    _fields_ = [
+        ("write_depth", ctypes.c_int),
+        ("write_chunk", ctypes.c_size_t),
+        ("write_mbps", ctypes.c_double),
+        ("read_depth", ctypes.c_int),
+        ("read_chunk", ctypes.c_size_t),
+        ("read_mbps", ctypes.c_double),
+    ]
+
+# autotune(ctx, scratch_offset, scratch_len, budget_ms, out*)
+lib.npu_nvme_autotune.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.c_uint64,
+    ctypes.c_uint32,
+    ctypes.POINTER(NPUNVMETune),
+]
+lib.npu_nvme_autotune.restype = ctypes.c_int
+lib.npu_nvme_get_tune.argtypes = [ctypes.POINTER(NPUNVMEContext), ctypes.POINTER(NPUNVMETune)]
+lib.npu_nvme_get_tune.restype = ctypes.c_int
+
+# 统计：各阶段 HDR 式对数直方图（ns），见 npu_nvme.h
+NPU_NVME_HIST_BUCKETS = 640
+NPU_NVME_STAGES = ("copy", "nvme", "queue", "e2e")
+
+class NPUNVMEHist(ctypes.Structure):
+    _fields_ = [
+        ("count", ctypes.c_uint64),
+        ("sum_ns", ctypes.c_uint64),
+        ("buckets", ctypes.c_uint64 * NPU_NVME_HIST_BUCKETS),
+    ]
+
+class NPUNVMEDirStats(ctypes.Structure):
+    _fields_ = [
+        ("batches", ctypes.c_uint64),
+        ("commands", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("errors", ctypes.c_uint64),
+        ("cache_hits", ctypes.c_uint64),
+        ("cache_bytes", ctypes.c_uint64),
+        ("cache_fills", ctypes.c_uint64),
+        ("cache_fill_bytes", ctypes.c_uint64),
+        ("hist", NPUNVMEHist * len(NPU_NVME_STAGES)),
+    ]
+
+class NPUNVMEStats(ctypes.Structure):
+    _fields_ = [
+        ("write", NPUNVMEDirStats),
+        ("read", NPUNVMEDirStats),
+        ("trims", ctypes.c_uint64),
+    ]
+
+lib.npu_nvme_get_stats.argtypes = [ctypes.POINTER(NPUNVMEContext), ctypes.POINTER(NPUNVMEStats)]
+lib.npu_nvme_get_stats.restype = ctypes.c_int
+lib.npu_nvme_reset_stats.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_reset_stats.restype = None
+lib.npu_nvme_hist_percentile.argtypes = [ctypes.POINTER(NPUNVMEHist), ctypes.c_double]
+lib.npu_nvme_hist_percentile.restype = ctypes.c_uint64
+
+lib.npu_nvme_get_queue_depth.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_get_queue_depth.restype = ctypes.c_int
+
+lib.npu_nvme_get_num_workers.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_get_num_workers.restype = ctypes.c_int
+
+lib.npu_nvme_get_num_devices.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_get_num_devices.restype = ctypes.c_int
+
+lib.npu_nvme_set_poll_mode.argtypes = [ctypes.POINTER(NPUNVMEContext), ctypes.c_int]
+lib.npu_nvme_set_poll_mode.restype = ctypes.c_int
+lib.npu_nvme_get_dma_policy.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_get_dma_policy.restype = ctypes.c_int
+lib.npu_nvme_get_numa_node.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_get_numa_node.restype = ctypes.c_int
+
+# 主机恢复缓存
+class NPUNVMECacheInfo(ctypes.Structure):
+    _fields_ = [
+        ("capacity", ctypes.c_size_t),
+        ("used", ctypes.c_size_t),
+        ("generation", ctypes.c_uint64),
+        ("evictions", ctypes.c_uint64),
+        ("hugetlb", ctypes.c_bool),
+    ]
+
+lib.npu_nvme_get_cache_info.argtypes = [ctypes.POINTER(NPUNVMEContext),
+                                        ctypes.POINTER(NPUNVMECacheInfo)]
+lib.npu_nvme_get_cache_info.restype = ctypes.c_int
+lib.npu_nvme_cache_clear.argtypes = [ctypes.POINTER(NPUNVMEContext)]
+lib.npu_nvme_cache_clear.restype = None
+
 # write_batch / read_batch
 lib.npu_nvme_write_batch.argtypes = [
     ctypes.POINTER(NPUNVMEContext),
@@ -50,69 +201,471 @@ lib.npu_nvme_read_batch.argtypes = [
 ]
 lib.npu_nvme_read_batch.restype = ctypes.c_int
 
+# plan_create / plan_execute_write / plan_execute_read / plan_destroy
+lib.npu_nvme_plan_create.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.POINTER(ctypes.c_void_p),
+    ctypes.POINTER(ctypes.c_uint64),
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_int
+]
+lib.npu_nvme_plan_create.restype = ctypes.c_void_p
+
+# 张量列表：4K 布局与按 chunk 切分在 C 侧完成，Python 只传每个参数的地址与大小
+lib.npu_nvme_layout_tensors.argtypes = [
+    ctypes.POINTER(ctypes.c_size_t), ctypes.c_int, ctypes.c_uint64, ctypes.POINTER(ctypes.c_uint64)
+]
+lib.npu_nvme_layout_tensors.restype = ctypes.c_uint64
+
+lib.npu_nvme_plan_create_tensors.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.POINTER(ctypes.c_void_p),   # void** npu_ptrs（每个参数一个）
+    ctypes.POINTER(ctypes.c_uint64),   # 每个参数的盘上偏移
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_int,
+    ctypes.c_size_t,                   # chunk_size
+    ctypes.POINTER(ctypes.c_int),      # 输出 chunk 数
+]
+lib.npu_nvme_plan_create_tensors.restype = ctypes.c_void_p
+
+lib.npu_nvme_plan_execute_write.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_plan_execute_write.restype = ctypes.c_int
+
+lib.npu_nvme_plan_execute_read.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_plan_execute_read.restype = ctypes.c_int
+
+lib.npu_nvme_plan_destroy.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_plan_destroy.restype = None
+
+# 增量写
+lib.npu_nvme_plan_set_incremental.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+lib.npu_nvme_plan_set_incremental.restype = ctypes.c_int
+
+lib.npu_nvme_plan_get_delta_stats.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_uint64),
+    ctypes.POINTER(ctypes.c_uint64),
+]
+lib.npu_nvme_plan_get_delta_stats.restype = ctypes.c_int
+
+# 压缩
+NPU_NVME_CODEC_NONE = 0
+NPU_NVME_CODEC_LZ4 = 1
+CODECS = {None: NPU_NVME_CODEC_NONE, "lz4": NPU_NVME_CODEC_LZ4}
+
+lib.npu_nvme_plan_set_compression.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_int,
+    ctypes.POINTER(ctypes.c_int),
+]
+lib.npu_nvme_plan_set_compression.restype = ctypes.c_int
+
+lib.npu_nvme_plan_get_compress_stats.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_uint64),
+    ctypes.POINTER(ctypes.c_uint64),
+]
+lib.npu_nvme_plan_get_compress_stats.restype = ctypes.c_int
+
+# 全零检测
+lib.npu_nvme_plan_set_zero_detect.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+lib.npu_nvme_plan_set_zero_detect.restype = ctypes.c_int
+
+lib.npu_nvme_plan_get_zero_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint64)]
+lib.npu_nvme_plan_get_zero_stats.restype = ctypes.c_int
+
+# CRC32C 校验
+NPU_NVME_ERR_CHECKSUM = -2
+
+lib.npu_nvme_plan_set_checksum.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+lib.npu_nvme_plan_set_checksum.restype = ctypes.c_int
+
+lib.npu_nvme_plan_get_checksums.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint32)]
+lib.npu_nvme_plan_get_checksums.restype = ctypes.c_int
+
+lib.npu_nvme_plan_set_expected_checksums.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint32)]
+lib.npu_nvme_plan_set_expected_checksums.restype = ctypes.c_int
+
+lib.npu_nvme_plan_get_mismatches.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint8)]
+lib.npu_nvme_plan_get_mismatches.restype = ctypes.c_int
+
+# 盘上 checkpoint（超级块 + 清单 + slot 轮换）
+NPU_NVME_MAX_NAME = 256
+NPU_NVME_MAX_DTYPE = 32
+NPU_NVME_MAX_DIMS = 8
+
+
+class NPUNVMETensor(ctypes.Structure):
+    _fields_ = [
+        ("name", ctypes.c_char * NPU_NVME_MAX_NAME),
+        ("dtype", ctypes.c_char * NPU_NVME_MAX_DTYPE),
+        ("ndim", ctypes.c_int32),
+        ("shape", ctypes.c_int64 * NPU_NVME_MAX_DIMS),
+        ("offset", ctypes.c_uint64),
+        ("size", ctypes.c_uint64),
+        ("crc32c", ctypes.c_uint32),
+    ]
+
+
+lib.npu_nvme_ckpt_open.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.c_int,
+    ctypes.c_uint64,
+    ctypes.POINTER(ctypes.c_void_p),
+]
+lib.npu_nvme_ckpt_open.restype = ctypes.c_int
+
+lib.npu_nvme_ckpt_close.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_ckpt_close.restype = None
+
+lib.npu_nvme_ckpt_generation.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_ckpt_generation.restype = ctypes.c_uint64
+
+lib.npu_nvme_ckpt_num_tensors.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_ckpt_num_tensors.restype = ctypes.c_int
+
+lib.npu_nvme_ckpt_get_tensors.argtypes = [ctypes.c_void_p, ctypes.POINTER(NPUNVMETensor), ctypes.c_int]
+lib.npu_nvme_ckpt_get_tensors.restype = ctypes.c_int
+
+lib.npu_nvme_ckpt_save.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(NPUNVMETensor),
+    ctypes.POINTER(ctypes.c_void_p),
+    ctypes.c_int,
+]
+lib.npu_nvme_ckpt_save.restype = ctypes.c_int
+
+lib.npu_nvme_ckpt_load.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(NPUNVMETensor),
+    ctypes.POINTER(ctypes.c_void_p),
+    ctypes.c_int,
+    ctypes.POINTER(ctypes.c_uint8),
+]
+lib.npu_nvme_ckpt_load.restype = ctypes.c_int
+
+lib.npu_nvme_plan_save_manifest.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+lib.npu_nvme_plan_save_manifest.restype = ctypes.c_int
+
+lib.npu_nvme_plan_load_manifest.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+lib.npu_nvme_plan_load_manifest.restype = ctypes.c_int
+
+# 异步接口（不在 Python 里注册回调，避免进度线程抢 GIL；完成状态靠 poll/wait）
+NPU_NVME_PENDING = 1
+
+lib.npu_nvme_plan_execute_write_async.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+lib.npu_nvme_plan_execute_write_async.restype = ctypes.c_void_p
+
+lib.npu_nvme_plan_execute_read_async.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+lib.npu_nvme_plan_execute_read_async.restype = ctypes.c_void_p
+
+lib.npu_nvme_poll.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_poll.restype = ctypes.c_int
+
+lib.npu_nvme_wait.argtypes = [ctypes.c_void_p, ctypes.c_int]
+lib.npu_nvme_wait.restype = ctypes.c_int
+
+lib.npu_nvme_handle_elapsed_ns.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_handle_elapsed_ns.restype = ctypes.c_uint64
+
+lib.npu_nvme_handle_free.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_handle_free.restype = None
+
+# 优先级流式读：同样不注册就绪回调，按参数 poll/wait 单个 item
+lib.npu_nvme_read_stream.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.POINTER(ctypes.c_void_p),
+    ctypes.POINTER(ctypes.c_uint64),
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_int,
+    ctypes.POINTER(ctypes.c_int),      # priority，越小越先读
+    ctypes.c_void_p, ctypes.c_void_p,  # ready_cb, ready_arg
+    ctypes.c_void_p, ctypes.c_void_p,  # cb, cb_arg
+]
+lib.npu_nvme_read_stream.restype = ctypes.c_void_p
+
+lib.npu_nvme_stream_wait.argtypes = [
+    ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_uint64)
+]
+lib.npu_nvme_stream_wait.restype = ctypes.c_int
+
+# 快照后排空：NPU 上的暂存区
+lib.npu_nvme_snapshot_create.argtypes = [ctypes.POINTER(NPUNVMEContext), ctypes.c_size_t]
+lib.npu_nvme_snapshot_create.restype = ctypes.c_void_p
+
+lib.npu_nvme_snapshot_destroy.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_snapshot_destroy.restype = None
+
+lib.npu_nvme_snapshot_take.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_void_p),
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_int,
+    ctypes.POINTER(ctypes.c_void_p),   # 输出：暂存区里的地址
+]
+lib.npu_nvme_snapshot_take.restype = ctypes.c_int
+
+# 多 rank 分片：盘上的分片表（1MB）之后按 rank 顺序排各 rank 的区域
+NPU_NVME_MAX_RANKS = 64
+NPU_NVME_SHARD_TABLE_BYTES = 1024 * 1024
+SHARD_TIMEOUT_MS = 600 * 1000
+
+class NPUNVMEShardLayout(ctypes.Structure):
+    _fields_ = [
+        ("job_id", ctypes.c_uint64),
+        ("epoch", ctypes.c_uint64),
+        ("world_size", ctypes.c_int32),
+        ("offset", ctypes.c_uint64 * NPU_NVME_MAX_RANKS),
+        ("len", ctypes.c_uint64 * NPU_NVME_MAX_RANKS),
+        ("shard_bytes", ctypes.c_uint64 * NPU_NVME_MAX_RANKS),
+    ]
+
+# shard_plan(ctx, table_offset, job_id, epoch, rank, world_size, shard_bytes, timeout_ms, layout*)
+lib.npu_nvme_shard_plan.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.c_uint64,
+    ctypes.c_uint64,
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.c_uint64,
+    ctypes.c_int,
+    ctypes.POINTER(NPUNVMEShardLayout),
+]
+lib.npu_nvme_shard_plan.restype = ctypes.c_int
+
+lib.npu_nvme_shard_commit.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.POINTER(NPUNVMEShardLayout),
+    ctypes.c_int,
+    ctypes.c_int,
+]
+lib.npu_nvme_shard_commit.restype = ctypes.c_int
+
+lib.npu_nvme_shard_open.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.POINTER(NPUNVMEShardLayout),
+]
+lib.npu_nvme_shard_open.restype = ctypes.c_int
+
+# 空间管理：命名空间的一段交给库分配，多个 tenant 的多个版本共用一块盘
+NPU_NVME_MAX_TENANT = 48
+NPU_NVME_ERR_NOSPACE = -3
+
+class NPUNVMEExtent(ctypes.Structure):
+    _fields_ = [
+        ("tenant", ctypes.c_char * NPU_NVME_MAX_TENANT),
+        ("version", ctypes.c_uint64),
+        ("offset", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("committed", ctypes.c_uint32),
+    ]
+
+class NPUNVMESpaceStats(ctypes.Structure):
+    _fields_ = [
+        ("total_bytes", ctypes.c_uint64),
+        ("used_bytes", ctypes.c_uint64),
+        ("reclaiming_bytes", ctypes.c_uint64),
+        ("largest_free", ctypes.c_uint64),
+        ("num_extents", ctypes.c_int32),
+    ]
+
+lib.npu_nvme_space_open.argtypes = [
+    ctypes.POINTER(NPUNVMEContext),
+    ctypes.c_uint64,
+    ctypes.c_uint64,
+    ctypes.c_uint64,
+    ctypes.POINTER(ctypes.c_void_p),
+]
+lib.npu_nvme_space_open.restype = ctypes.c_int
+lib.npu_nvme_space_close.argtypes = [ctypes.c_void_p]
+lib.npu_nvme_space_close.restype = None
+lib.npu_nvme_space_alloc.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64,
+                                     ctypes.POINTER(NPUNVMEExtent)]
+lib.npu_nvme_space_alloc.restype = ctypes.c_int
+lib.npu_nvme_space_commit.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64]
+lib.npu_nvme_space_commit.restype = ctypes.c_int
+lib.npu_nvme_space_free.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64]
+lib.npu_nvme_space_free.restype = ctypes.c_int
+lib.npu_nvme_space_retain.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+lib.npu_nvme_space_retain.restype = ctypes.c_int
+lib.npu_nvme_space_find.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64,
+                                    ctypes.POINTER(NPUNVMEExtent)]
+lib.npu_nvme_space_find.restype = ctypes.c_int
+lib.npu_nvme_space_list.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                    ctypes.POINTER(NPUNVMEExtent), ctypes.c_int]
+lib.npu_nvme_space_list.restype = ctypes.c_int
+lib.npu_nvme_space_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(NPUNVMESpaceStats)]
+lib.npu_nvme_space_get_stats.restype = ctypes.c_int
+
+
+def default_job_id():
+    """同一次训练的各 rank 取值相同：优先 NPU_NVME_JOB_ID / torchrun 的 run id，否则用启动器进程号"""
+    for key in ("NPU_NVME_JOB_ID", "TORCHELASTIC_RUN_ID"):
+        if os.environ.get(key):
+            return os.environ[key]
+    if os.environ.get("MASTER_PORT"):
+        return os.environ.get("MASTER_ADDR", "") + ":" + os.environ["MASTER_PORT"]
+    return str(os.getppid())
+
+
+def create_tensor_plan(ctx, ptrs, offsets, sizes, chunk_size):
+    """由参数列表创建 C 侧传输计划，切块在 C 侧完成（数组在 C 侧复制，无需保活）。
+    返回 (plan, chunk 数)；chunk 顺序为参数顺序、参数内从前到后"""
+    num = len(ptrs)
+    num_chunks = ctypes.c_int(0)
+    plan = lib.npu_nvme_plan_create_tensors(ctx,
+                                            (ctypes.c_void_p * num)(*ptrs),
+                                            (ctypes.c_uint64 * num)(*offsets),
+                                            (ctypes.c_size_t * num)(*sizes),
+                                            num, chunk_size, ctypes.byref(num_chunks))
+    if not plan:
+        raise RuntimeError("npu_nvme_plan_create_tensors failed")
+    return plan, num_chunks.value
+
+
+def layout_tensors(sizes, base):
+    """参数从 base 起 4K 对齐紧密排列，返回 (每个参数的偏移, 总跨度)"""
+    num = len(sizes)
+    offs = (ctypes.c_uint64 * num)()
+    span = lib.npu_nvme_layout_tensors((ctypes.c_size_t * num)(*sizes), num, base, offs)
+    return list(offs), span
+
+
+def set_plan_compression(plan, codec, elem_sizes):
+    """对计划打开压缩；elem_sizes 与 chunk 一一对应（byte-shuffle 的元素宽度）"""
+    c_elems = (ctypes.c_int * len(elem_sizes))(*elem_sizes)
+    if lib.npu_nvme_plan_set_compression(plan, CODECS[codec], c_elems) != 0:
+        raise RuntimeError("npu_nvme_plan_set_compression failed")
+
+
+def chunk_elem_sizes(params: List[Dict], chunk_size: int):
+    """按 C 侧的切分规则（参数内每 chunk_size 一块）展开每个 chunk 的元素宽度"""
+    return [p["elem"] for p in params
+            for _ in range(int(math.ceil(p["size"] / chunk_size)))]
+
+
+def chunk_count(size: int, chunk_size: int):
+    return int(math.ceil(size / chunk_size))
+
 
 # ============================================================
-# 工具：分块与合包
+# 异步结果
 # ============================================================
-def build_chunks(params: List[Dict], chunk_size: int):
+class CheckpointFuture:
     """
-    将一组参数（含 ptr/size/offset_on_nvme）切成 <= chunk_size 的块。
-    返回 (chunks, total_size)
-    chunks: List[ (ptr, nvme_offset, size) ]
+    一次异步 save/load。done() 非阻塞查询，wait(timeout) 阻塞等待，
+    也可以在协程里 await。完成后返回与同步接口相同的 (total, chunks, time, bw)，
+    time 为 C 侧记下的提交到进度线程上执行完的时间，与何时 done()/wait() 无关。
     """
-    chunks = []
-    nvme_offset = 0
-    for p in params:
-        ptr = p["ptr"]
-        remaining = p["size"]
-        inner_off = 0
-        while remaining > 0:
-            take = min(remaining, chunk_size)
-            chunks.append((
-                ctypes.c_void_p(ptr + inner_off),   # NPU 地址 + 偏移
-                ctypes.c_uint64(nvme_offset),       # NVMe 偏移（无空洞）
-                ctypes.c_size_t(take)                # 本块大小
-            ))
-            remaining -= take
-            inner_off += take
-            nvme_offset += int(math.ceil(take / 4096.0) * 4096)  # NVMe 按 4K 对齐推进偏移
-    return chunks, nvme_offset
-
-
-def rebuild_chunks_from_meta(model: torch.nn.Module, meta: Dict, chunk_size: int):
+
+    def __init__(self, handle, kind: str, total: int, num_chunks: int, on_done=None,
+                 check=None):
+        self._handle = handle
+        self._check = check
+        self._kind = kind
+        self._total = total
+        self._num = num_chunks
+        self._on_done = on_done
+        self._result = None
+        # 快照保存时为训练步被占用的时间（秒），此时参数已可更新；否则为 None
+        self.stall = None
+
+    def _finish(self, rc: int):
+        dt = max(lib.npu_nvme_handle_elapsed_ns(self._handle), 1) / 1e9
+        lib.npu_nvme_handle_free(self._handle)
+        self._handle = None
+        if self._check is not None:
+            self._check(rc)
+        elif rc != 0:
+            raise RuntimeError(f"{self._kind} failed")
+        if self._on_done is not None:
+            self._on_done()
+        bw = self._total / 1024 / 1024 / dt
+        print(f"[{self._kind}] async done in {dt:.3f}s, BW={bw:.1f} MB/s")
+        self._result = (self._total, self._num, dt, bw)
+        return self._result
+
+    def done(self) -> bool:
+        if self._handle is None:
+            return True
+        rc = lib.npu_nvme_poll(self._handle)
+        if rc == NPU_NVME_PENDING:
+            return False
+        self._finish(rc)
+        return True
+
+    def wait(self, timeout: float = None):
+        """阻塞直到完成；超时返回 None"""
+        if self._handle is None:
+            return self._result
+        ms = -1 if timeout is None else int(timeout * 1000)
+        rc = lib.npu_nvme_wait(self._handle, ms)
+        if rc == NPU_NVME_PENDING:
+            return None
+        return self._finish(rc)
+
+    def result(self):
+        return self.wait()
+
+    def __await__(self):
+        while not self.done():
+            yield from asyncio.sleep(0.001).__await__()
+        return self._result
+
+
+class StreamingLoad(CheckpointFuture):
     """
-    根据元数据和 chunk_size，按与写入时一致的规则重建块列表。
+    优先级流式恢复（load_stream 返回）。参数按给定顺序读，某个参数的数据全部
+    上传到 NPU 后即可使用：ready(name) 非阻塞查询，wait_param(name) 阻塞等待。
+    整体完成与 CheckpointFuture 相同；ready_time(name) 为该参数的就绪时刻（秒，
+    相对读开始执行），time_to_first 为第一个参数的就绪时刻。
     """
-    params = []
-    for name, param in model.named_parameters():
-        if name not in meta:
-            continue
-        info = meta[name]
-        params.append({
-            "ptr": param.data_ptr(),
-            "size": info["size"],
-            "offset": info["offset"]
-        })
-    # 按 offset 排序，确保顺序一致
-    params.sort(key=lambda x: x["offset"])
-    # 重建块：沿用当初的连续布局
-    chunks = []
-    for p in params:
-        ptr = p["ptr"]
-        remaining = p["size"]
-        nvme_off = p["offset"]
-        inner_off = 0
-        while remaining > 0:
-            take = min(remaining, chunk_size)
-            chunks.append((
-                ctypes.c_void_p(ptr + inner_off),
-                ctypes.c_uint64(nvme_off),
-                ctypes.c_size_t(take)
-            ))
-            remaining -= take
-            inner_off += take
-            nvme_off += int(math.ceil(take / 4096.0) * 4096)
-    return chunks
+
+    def __init__(self, handle, total: int, order: List[str]):
+        super().__init__(handle, "Load", total, len(order))
+        self._order = order
+        self._index = {n: i for i, n in enumerate(order)}   # 参数名 -> item
+        self._state = {}   # item -> (rc, ready_ns)，完成时一次取全
+
+    def _param(self, name: str, timeout_ms: int):
+        """返回参数的就绪时刻（ns）；未就绪返回 None，失败抛异常"""
+        i = self._index[name]
+        if i not in self._state:
+            ns = ctypes.c_uint64(0)
+            rc = lib.npu_nvme_stream_wait(self._handle, i, timeout_ms, ctypes.byref(ns))
+            if rc == NPU_NVME_PENDING:
+                return None
+            self._state[i] = (rc, ns.value)
+        rc, ns = self._state[i]
+        if rc != 0:
+            raise RuntimeError(f"stream load failed for {name}")
+        return ns
+
+    def ready(self, name: str) -> bool:
+        return self._param(name, 0) is not None
+
+    def wait_param(self, name: str, timeout: float = None) -> bool:
+        """阻塞直到参数可用；超时返回 False"""
+        ms = -1 if timeout is None else int(timeout * 1000)
+        return self._param(name, ms) is not None
+
+    def ready_time(self, name: str) -> float:
+        return self._param(name, -1) / 1e9
+
+    @property
+    def time_to_first(self) -> float:
+        return self.ready_time(self._order[0]) if self._order else 0.0
+
+    def _finish(self, rc: int):
+        if rc == 0:
+            last = max(self._param(n, -1) for n in self._order)
+            print(f"[Load] stream: first param {self._order[0]!r} ready in "
+                  f"{self.time_to_first * 1000:.2f} ms, all in {last / 1e6:.2f} ms")
+        return super()._finish(rc)
 
 
 # ============================================================
@@ -126,36 +679,384 @@ class DirectCheckpoint:
         pipeline_depth: int = 4,
         requested_chunk_size: int = 4 * 1024 * 1024,
         enable_profiling: bool = False,
+        num_workers: int = 1,
+        stripe_unit: int = 0,
+        incremental: bool = False,
+        compression: str = None,
+        zero_detect: bool = True,
+        checksum: bool = True,
+        device_format: bool = False,
+        ckpt_base: int = 0,
+        num_slots: int = 2,
+        slot_size: int = 0,
+        dma_mem: int = 0,
+        poll_mode: str = "adaptive",
+        dma_policy: str = "spdk_registered",
+        numa_node=None,
+        npu_pci_addr: str = None,
+        host_cache: int = 0,
+        rank: int = 0,
+        world_size: int = 1,
+        shm_id: int = None,
+        shard_table: int = 0,
+        job_id: str = None,
+        snapshot_budget: int = 0,
+        space_base: int = None,
+        space_len: int = 0,
+        tenant: str = None,
+        keep_versions: int = 0,
     ):
         self.ctx = ctypes.POINTER(NPUNVMEContext)()
         self.enable_profiling = enable_profiling
+        # 增量模式：未变化的块不写盘，清单与元数据放在一起（<meta_path>.manifest）
+        self.incremental = incremental
+        # 压缩：None 或 "lz4"；压缩长度同样记在 <meta_path>.manifest，读回时需要
+        if compression not in CODECS:
+            raise ValueError(f"unknown compression {compression!r}")
+        self.compression = compression
+        # 全零 chunk（未初始化的 buffer、剪枝后的权重等）不传数据，改发 Deallocate / Write Zeroes；
+        # 标记同样记在 <meta_path>.manifest，load 时这些 chunk 不读盘，直接在 NPU 上清零
+        self.zero_detect = zero_detect
+        # 每个 chunk 的 CRC32C 记在元数据里，load 时逐 chunk 比对，出错的参数直接报出来
+        self.checksum = checksum
+        # 盘上格式：名字/形状/dtype/代号都写在 NVMe 上，不依赖 meta 文件；
+        # 多个 slot 轮换，保存中途崩溃不影响上一个 checkpoint。
+        # 该模式总是带 CRC32C，不支持增量与压缩
+        self.device_format = device_format
+        if device_format and (incremental or compression):
+            raise ValueError("device_format does not support incremental or compression")
+        self._ckpt_args = (ckpt_base, num_slots, slot_size)
+        self._ckpt = None
+        # adaptive 按近期服务时间在预测的完成时刻附近自旋、其余时间睡眠，给 dataloader 留出 CPU
+        if poll_mode not in POLL_MODES:
+            raise ValueError(f"unknown poll_mode {poll_mode!r}")
+        # 暂存 buffer 要让 SPDK 与 ACL 都视为锁页内存，否则每个 chunk 的 D2H/H2D 多一次内部拷贝
+        if dma_policy not in DMA_POLICIES:
+            raise ValueError(f"unknown dma_policy {dma_policy!r}")
+        # DMA buffer 与轮询线程放在控制器所在的 NUMA 节点上（未知时用 NPU 的节点）；
+        # numa_node 为整数时强制该节点，"off" 不区分节点
+        if numa_node is None:
+            numa_node = NUMA_AUTO
+        elif numa_node == "off":
+            numa_node = NUMA_OFF
+        elif not isinstance(numa_node, int) or numa_node < 0:
+            raise ValueError(f"invalid numa_node {numa_node!r}")
+        # 主机恢复缓存（字节，0 关闭）：保存时每个 chunk 在主机内存里留一份，
+        # 回滚到最近一次保存（NaN 后重载等）时直接 H2D，不读盘
+        self.host_cache = host_cache
+        # 分片：同一节点的 world_size 个 rank 经 SPDK 多进程（相同 shm_id）共用一块 SSD，
+        # 每次保存先在盘上的分片表里交换大小、划出互不重叠的区域，
+        # 各 rank 的元数据写到 <meta_path>.rank<r>，全部提交后 rank 0 合并成 <meta_path>
+        self.rank = rank
+        self.world_size = world_size
+        self.sharded = world_size > 1
+        if self.sharded and device_format:
+            raise ValueError("device_format does not support sharding")
+        job = job_id or default_job_id()
+        self._shard_job = zlib.crc32(job.encode()) | (len(job) << 32)
+        self._shard_table = shard_table
+        self._shard_epoch = 0
+        self._shard_layout = None
+        if shm_id is None:
+            shm_id = (self._shard_job & 0x7fff) if self.sharded else -1
+        # 快照后排空：save_async 先把参数 D2D 拷进 NPU 上 snapshot_budget 字节的暂存区，
+        # 放不下的参数当场直接写盘，之后即可 optimizer.step；暂存区在后台写盘。
+        # 两部分各用一个计划，不支持增量与压缩（两者的清单按单个计划记录）
+        if snapshot_budget and (incremental or compression or device_format):
+            raise ValueError("snapshot_budget does not support incremental, compression "
+                             "or device_format")
+        self.snapshot_budget = snapshot_budget
+        self._snap = None
+        self._snap_plans = None
+        # 空间管理：space_base 非 None 时每次保存从 [space_base, space_base+space_len)
+        # （0 表示到盘尾）里分配一段新的连续区域，提交后只保留该 tenant 最新的
+        # keep_versions 个版本（0 不清理），旧版本在后台 Deallocate 回收。
+        # 多个任务用不同的 tenant（默认取 job_id）共用一块盘，不用手工协调偏移。
+        # 每次保存位置不同：不支持增量，也不与分片、盘上格式同时使用
+        if space_base is not None and (incremental or self.sharded or device_format):
+            raise ValueError("space_base does not support incremental, sharding or device_format")
+        self.tenant = (tenant or job)[:NPU_NVME_MAX_TENANT - 1]
+        self.keep_versions = keep_versions
+        self._space = None
+        self._space_ext = None
 
-        rc = lib.npu_nvme_init(
-            ctypes.byref(self.ctx),
-            nvme_addr.encode(),
-            npu_device_id,
-            pipeline_depth,
-            requested_chunk_size,
-            enable_profiling
-        )
+        # nvme_addr 可为单个地址或地址列表；列表时按 stripe_unit 做条带
+        if isinstance(nvme_addr, str):
+            addrs = [nvme_addr]
+        else:
+            addrs = list(nvme_addr)
+        c_addrs = (ctypes.c_char_p * len(addrs))(*[a.encode() for a in addrs])
+        # pipeline_depth 即每个 worker 的在途命令数（最多 256）；dma_mem 为所有 worker
+        # 合计的 DMA 内存字节数，0 取默认。放不下时 C 侧缩小单条命令，大 chunk 自动拆成多条命令
+        opts = NPUNVMEOpts()
+        lib.npu_nvme_opts_init(ctypes.byref(opts))
+        opts.nvme_pci_addrs = c_addrs
+        opts.num_devices = len(addrs)
+        opts.stripe_unit = stripe_unit
+        opts.npu_device_id = npu_device_id
+        opts.queue_depth = pipeline_depth
+        opts.chunk_size = requested_chunk_size
+        opts.dma_mem_bytes = dma_mem
+        opts.num_workers = num_workers
+        opts.enable_profiling = enable_profiling
+        opts.poll_mode = POLL_MODES[poll_mode]
+        opts.shm_id = shm_id
+        opts.dma_policy = DMA_POLICIES[dma_policy]
+        opts.numa_node = numa_node
+        opts.npu_pci_addr = npu_pci_addr.encode() if npu_pci_addr else None
+        opts.host_cache_bytes = host_cache
+        rc = lib.npu_nvme_init_opts(ctypes.byref(self.ctx), ctypes.byref(opts))
         if rc != 0:
             raise RuntimeError("npu_nvme_init failed")
+        if space_base is not None:
+            sp = ctypes.c_void_p()
+            if lib.npu_nvme_space_open(self.ctx, space_base, space_len, 0, ctypes.byref(sp)) != 0:
+                lib.npu_nvme_cleanup(self.ctx)
+                raise RuntimeError(f"npu_nvme_space_open failed at offset {space_base}")
+            self._space = sp
 
-        # 生效的 chunk_size（已被设备上限裁剪）
+        # 单条 NVMe 命令的长度（已被设备上限与 DMA 内存裁剪）
         self.chunk_size = lib.npu_nvme_get_max_transfer(self.ctx)
         print(f"[DirectCheckpoint] init ok. "
-              f"pipeline_depth={pipeline_depth}, "
+              f"queue_depth={lib.npu_nvme_get_queue_depth(self.ctx)}, "
+              f"devices={lib.npu_nvme_get_num_devices(self.ctx)}, "
+              f"workers={lib.npu_nvme_get_num_workers(self.ctx)}, "
               f"requested_chunk={requested_chunk_size/1024/1024:.2f}MB, "
-              f"effective_chunk={self.chunk_size/1024/1024:.2f}MB")
-        self.chunk_size = requested_chunk_size
+              f"command={self.chunk_size/1024/1024:.2f}MB, "
+              f"dma={[k for k, v in DMA_POLICIES.items() if v == lib.npu_nvme_get_dma_policy(self.ctx)][0]}, "
+              f"numa_node={lib.npu_nvme_get_numa_node(self.ctx)}")
+        # C 侧按 requested_chunk_size（向下取 4K 整数倍）切块，超过单条命令的块再拆；0 时按单条命令切
+        self.chunk_size = max(4096, (requested_chunk_size or self.chunk_size) // 4096 * 4096)
         self.meta = {}
         self.total_size = 0
+        # 布局不变时复用的传输计划：(key, plan, 附加信息)
+        self._save_plan = None
+        self._load_plan = None
+        # 在途的异步 save/load（同一时刻最多一个，计划在完成前不能替换）
+        self._pending = None
+
+    def _drain(self):
+        if self._pending is not None:
+            self._pending.wait()
+            self._pending = None
+
+    def _sync_compute(self):
+        """
+        库的 D2H/H2D/D2D 拷贝在它自己的 stream 上，与训练用的 stream 没有先后关系：
+        先等当前 stream 上已排队的 kernel（例如 optimizer.step 写参数、前向读参数）执行完，
+        保存时才不会拷到写了一半的参数，读回时才不会覆盖还在被读的参数。
+        """
+        npu = getattr(torch, "npu", None)
+        if npu is not None and npu.is_available():
+            npu.current_stream().synchronize()
+
+    def _drop_plans(self):
+        for cached in (self._save_plan, self._load_plan):
+            if cached is not None:
+                lib.npu_nvme_plan_destroy(cached[1])
+        self._save_plan = None
+        self._load_plan = None
+        if self._snap_plans is not None:
+            for plan, _ in self._snap_plans[1]:
+                lib.npu_nvme_plan_destroy(plan)
+            self._snap_plans = None
 
     def cleanup(self):
         if self.ctx:
+            self._drain()
+            self._drop_plans()
+            if self._ckpt:
+                lib.npu_nvme_ckpt_close(self._ckpt)
+                self._ckpt = None
+            if self._snap:
+                lib.npu_nvme_snapshot_destroy(self._snap)
+                self._snap = None
+            if self._space:
+                lib.npu_nvme_space_close(self._space)
+                self._space = None
             lib.npu_nvme_cleanup(self.ctx)
             self.ctx = None
 
+    def set_poll_mode(self, mode: str):
+        if mode not in POLL_MODES or lib.npu_nvme_set_poll_mode(self.ctx, POLL_MODES[mode]) != 0:
+            raise ValueError(f"unknown poll_mode {mode!r}")
+
+    def autotune(self, scratch_offset: int, scratch_len: int = 256 * 1024 * 1024,
+                 budget_ms: int = 2000):
+        """
+        在 NVMe 的 scratch 区域（内容会被覆盖）上扫描在途命令数与单条命令长度，
+        读写分别取最快的组合。结果按 SSD 序列号/型号缓存，之后的 init 直接套用。
+        已有计划按旧设置切分，这里丢掉，下次 save/load 重新创建。
+        """
+        self._drain()
+        self._drop_plans()
+        tune = NPUNVMETune()
+        rc = lib.npu_nvme_autotune(self.ctx, scratch_offset, scratch_len, budget_ms,
+                                   ctypes.byref(tune))
+        if rc != 0:
+            raise RuntimeError("npu_nvme_autotune failed")
+        return {
+            "write_depth": tune.write_depth, "write_chunk": tune.write_chunk,
+            "write_mbps": tune.write_mbps,
+            "read_depth": tune.read_depth, "read_chunk": tune.read_chunk,
+            "read_mbps": tune.read_mbps,
+        }
+
+    def stats(self):
+        """
+        上次 reset_stats 以来的读写统计：计数器，以及每个阶段
+        （copy / nvme / queue / e2e）的 p50 / p99 / p999 / 平均值（us）；
+        trims 为空间回收完成的 Deallocate 数，不计入 write。
+        """
+        st = NPUNVMEStats()
+        if lib.npu_nvme_get_stats(self.ctx, ctypes.byref(st)) != 0:
+            raise RuntimeError("npu_nvme_get_stats failed")
+        out = {}
+        for kind in ("write", "read"):
+            ds = getattr(st, kind)
+            d = {"batches": ds.batches, "commands": ds.commands,
+                 "bytes": ds.bytes, "errors": ds.errors,
+                 "cache_hits": ds.cache_hits, "cache_bytes": ds.cache_bytes,
+                 "cache_fills": ds.cache_fills, "cache_fill_bytes": ds.cache_fill_bytes}
+            # 命中率只对读有意义；写方向给出复制进缓存的比例
+            if kind == "read":
+                d["cache_hit_rate"] = ds.cache_hits / ds.commands if ds.commands else 0.0
+            else:
+                d["cache_fill_rate"] = ds.cache_fills / ds.commands if ds.commands else 0.0
+            for i, stage in enumerate(NPU_NVME_STAGES):
+                h = ds.hist[i]
+                d[stage] = {
+                    "count": h.count,
+                    "mean_us": h.sum_ns / h.count / 1000.0 if h.count else 0.0,
+                    "p50_us": lib.npu_nvme_hist_percentile(ctypes.byref(h), 50.0) / 1000.0,
+                    "p99_us": lib.npu_nvme_hist_percentile(ctypes.byref(h), 99.0) / 1000.0,
+                    "p999_us": lib.npu_nvme_hist_percentile(ctypes.byref(h), 99.9) / 1000.0,
+                }
+            out[kind] = d
+        out["trims"] = st.trims
+        return out
+
+    def reset_stats(self):
+        lib.npu_nvme_reset_stats(self.ctx)
+
+    def cache_info(self):
+        """主机恢复缓存的容量 / 占用（字节）、写批次号与淘汰数；未打开时容量为 0"""
+        info = NPUNVMECacheInfo()
+        if lib.npu_nvme_get_cache_info(self.ctx, ctypes.byref(info)) != 0:
+            raise RuntimeError("npu_nvme_get_cache_info failed")
+        return {"capacity": info.capacity, "used": info.used, "generation": info.generation,
+                "evictions": info.evictions, "hugetlb": info.hugetlb}
+
+    def cache_clear(self):
+        """其它进程改过盘上的 checkpoint 后调用，之后的读全部读盘"""
+        lib.npu_nvme_cache_clear(self.ctx)
+
+    def space_info(self):
+        """空间管理的占用统计与本 tenant 的版本（从新到旧）；未启用时返回 None"""
+        if not self._space:
+            return None
+        st = NPUNVMESpaceStats()
+        lib.npu_nvme_space_get_stats(self._space, ctypes.byref(st))
+        exts = (NPUNVMEExtent * max(st.num_extents, 1))()
+        n = lib.npu_nvme_space_list(self._space, self.tenant.encode(), exts, st.num_extents)
+        return {
+            "total": st.total_bytes, "used": st.used_bytes,
+            "reclaiming": st.reclaiming_bytes, "largest_free": st.largest_free,
+            "versions": [{"version": e.version, "offset": e.offset, "bytes": e.bytes,
+                          "committed": bool(e.committed)} for e in exts[:max(n, 0)]],
+        }
+
+    def _place(self, span):
+        """本次保存的起点：启用空间管理时分配新版本，否则按分片表划分（不分片时为 0）"""
+        if not self._space:
+            return self._shard_plan(span)
+        ext = NPUNVMEExtent()
+        rc = lib.npu_nvme_space_alloc(self._space, self.tenant.encode(), max(span, 1),
+                                      ctypes.byref(ext))
+        if rc == NPU_NVME_ERR_NOSPACE:
+            raise RuntimeError(f"no room for {span/1024/1024:.2f}MB in the checkpoint space "
+                               f"(tenant {self.tenant}); lower keep_versions or enlarge space_len")
+        if rc != 0:
+            raise RuntimeError("npu_nvme_space_alloc failed")
+        self._space_ext = ext
+        print(f"[Save] {self.tenant} version {ext.version} at offset {ext.offset}")
+        return ext.offset
+
+    def _commit(self, meta_path):
+        """数据与元数据都写完：提交本版本并清理多余的旧版本，或提交分片"""
+        if not self._space:
+            return self._shard_commit(meta_path)
+        ext, self._space_ext = self._space_ext, None
+        tenant = self.tenant.encode()
+        if lib.npu_nvme_space_commit(self._space, tenant, ext.version) != 0:
+            raise RuntimeError(f"npu_nvme_space_commit failed for version {ext.version}")
+        if self.keep_versions > 0:
+            n = lib.npu_nvme_space_retain(self._space, tenant, self.keep_versions)
+            if n > 0:
+                print(f"[Save] released {n} old versions of {self.tenant}")
+
+    def _abort(self):
+        """写失败：本次分配的版本立刻释放（进程退出时没提交的也会在下次 open 回收）"""
+        if self._space and self._space_ext is not None:
+            lib.npu_nvme_space_free(self._space, self.tenant.encode(), self._space_ext.version)
+            self._space_ext = None
+
+    # --------------------------------------------------------
+    # 多 rank 分片
+    # --------------------------------------------------------
+    def _rank_path(self, meta_path):
+        return f"{meta_path}.rank{self.rank}" if self.sharded else meta_path
+
+    def _shard_plan(self, shard_bytes):
+        """与其它 rank 交换本次保存的大小，返回本 rank 区域的起点；不分片时为 0"""
+        if not self.sharded:
+            return 0
+        self._shard_epoch += 1
+        layout = NPUNVMEShardLayout()
+        rc = lib.npu_nvme_shard_plan(self.ctx, self._shard_table, self._shard_job,
+                                     self._shard_epoch, self.rank, self.world_size,
+                                     shard_bytes, SHARD_TIMEOUT_MS, ctypes.byref(layout))
+        if rc != 0:
+            raise RuntimeError(f"npu_nvme_shard_plan failed for rank {self.rank} (rc={rc})")
+        self._shard_layout = layout
+        return layout.offset[self.rank]
+
+    def _shard_commit(self, meta_path):
+        """本 rank 的数据与元数据已写完；全部 rank 提交后由 rank 0 合并出全局元数据"""
+        if not self.sharded:
+            return
+        rc = lib.npu_nvme_shard_commit(self.ctx, self._shard_table,
+                                       ctypes.byref(self._shard_layout), self.rank,
+                                       SHARD_TIMEOUT_MS)
+        if rc != 0:
+            raise RuntimeError(f"npu_nvme_shard_commit failed for rank {self.rank} (rc={rc})")
+        if self.rank != 0:
+            return
+        layout = self._shard_layout
+        merged = {
+            "sharded": True,
+            "world_size": self.world_size,
+            "epoch": layout.epoch,
+            "ranks": [{
+                "offset": layout.offset[r],
+                "len": layout.len[r],
+                "meta": torch.load(f"{meta_path}.rank{r}"),
+            } for r in range(self.world_size)],
+        }
+        torch.save(merged, meta_path)
+        print(f"[Save] merged {self.world_size} rank manifests into {meta_path}")
+
+    def _load_meta(self, meta_path):
+        meta = torch.load(meta_path)
+        if not meta.get("sharded"):
+            if self.sharded:
+                raise RuntimeError(f"{meta_path} is not a sharded checkpoint")
+            return meta
+        if meta["world_size"] != self.world_size:
+            raise RuntimeError(f"{meta_path} has {meta['world_size']} shards, "
+                               f"world_size is {self.world_size}")
+        return meta["ranks"][self.rank]["meta"]
+
     def _prepare_params(self, model: torch.nn.Module):
         params = []
         for name, p in model.named_parameters():
@@ -170,10 +1071,13 @@ class DirectCheckpoint:
                 "size": size,
                 "shape": list(p.shape),
                 "dtype": str(p.dtype),
+                "elem": p.element_size(),
             })
         return params
 
-    def save(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
+    def _prepare_save(self, model: torch.nn.Module, meta_path: str):
+        self._drain()
+        self._sync_compute()
         params = self._prepare_params(model)
         # 输出参数信息到params.csv，便于调试
         if self.enable_profiling:
@@ -181,76 +1085,446 @@ class DirectCheckpoint:
                 f.write("name,ptr,size,shape,dtype\n")
                 for p in params:
                     f.write(f"{p['name']},{p['ptr']},{p['size']},\"{p['shape']}\",{p['dtype']}\n")  
-        nvme_offset = 0
-        layout = []
-        for p in params:
-            layout.append({
-                **p,
-                "offset": nvme_offset
-            })
-            nvme_offset += int(math.ceil(p["size"] / 4096.0) * 4096)
-
-        # 生成 chunk 列表
-        chunks, total = build_chunks(layout, self.chunk_size)
+        # 参数地址与大小不变时直接复用上次的计划；否则布局与切块交给 C 侧
+        sizes = [p["size"] for p in params]
+        _, span = layout_tensors(sizes, 0)
+        base = self._place(span)
+        key = (self.chunk_size, base, tuple((p["ptr"], p["size"]) for p in params))
+        if self._save_plan is None or self._save_plan[0] != key:
+            offsets, total = layout_tensors(sizes, base)
+            layout = [{**p, "offset": off} for p, off in zip(params, offsets)]
+            plan, num = create_tensor_plan(self.ctx, [p["ptr"] for p in params], offsets, sizes,
+                                           self.chunk_size)
+            if self.incremental:
+                if lib.npu_nvme_plan_set_incremental(plan, True) != 0:
+                    raise RuntimeError("npu_nvme_plan_set_incremental failed")
+                # 同布局的旧清单（例如进程重启前）可以直接续上
+                manifest = (meta_path + ".manifest").encode()
+                if lib.npu_nvme_plan_load_manifest(plan, manifest) == 0:
+                    print(f"[Save] resumed manifest {meta_path}.manifest")
+            if self.compression:
+                set_plan_compression(plan, self.compression,
+                                     chunk_elem_sizes(layout, self.chunk_size))
+            if self.zero_detect and lib.npu_nvme_plan_set_zero_detect(plan, True) != 0:
+                raise RuntimeError("npu_nvme_plan_set_zero_detect failed")
+            if self.checksum and lib.npu_nvme_plan_set_checksum(plan, True) != 0:
+                raise RuntimeError("npu_nvme_plan_set_checksum failed")
+            if self._save_plan is not None:
+                lib.npu_nvme_plan_destroy(self._save_plan[1])
+            self._save_plan = (key, plan, (layout, total, num))
+        _, plan, (layout, total, num) = self._save_plan
         self.total_size = total
-        print(f"[Save] params={len(params)}, chunks={len(chunks)}, "
+        print(f"[Save] params={len(params)}, chunks={num}, "
               f"total={total/1024/1024:.2f}MB, chunk_size={self.chunk_size/1024/1024:.2f}MB")
+        return plan, layout, total, num
 
-        # 准备 ctypes 数组
-        num = len(chunks)
-        c_ptrs = (ctypes.c_void_p * num)()
-        c_offs = (ctypes.c_uint64 * num)()
-        c_sizes = (ctypes.c_size_t * num)()
-        for i, (p, o, s) in enumerate(chunks):
-            c_ptrs[i] = p
-            c_offs[i] = o
-            c_sizes[i] = s
+    def _report_delta(self, meta_path):
+        if not self.incremental and not self.compression and not self.zero_detect:
+            return
+        plan = self._save_plan[1]
+        lib.npu_nvme_plan_save_manifest(plan, (meta_path + ".manifest").encode())
+        if self.zero_detect:
+            zero = ctypes.c_uint64()
+            lib.npu_nvme_plan_get_zero_stats(plan, ctypes.byref(zero))
+            if zero.value:
+                print(f"[Save] zero chunks: {zero.value/1024/1024:.2f}MB not transferred")
+        if self.compression:
+            raw = ctypes.c_uint64()
+            stored = ctypes.c_uint64()
+            lib.npu_nvme_plan_get_compress_stats(plan, ctypes.byref(raw), ctypes.byref(stored))
+            ratio = raw.value / stored.value if stored.value else 1.0
+            print(f"[Save] {self.compression}: {raw.value/1024/1024:.2f}MB -> "
+                  f"{stored.value/1024/1024:.2f}MB ({ratio:.2f}x)")
+        if not self.incremental:
+            return
+        written = ctypes.c_uint64()
+        skipped = ctypes.c_uint64()
+        lib.npu_nvme_plan_get_delta_stats(plan, ctypes.byref(written), ctypes.byref(skipped))
+        total = written.value + skipped.value
+        ratio = skipped.value / total * 100 if total else 0.0
+        print(f"[Save] incremental: wrote {written.value/1024/1024:.2f}MB, "
+              f"skipped {skipped.value/1024/1024:.2f}MB unchanged ({ratio:.1f}%)")
 
-        t0 = time.time()
-        rc = lib.npu_nvme_write_batch(self.ctx, c_ptrs, c_offs, c_sizes, num)
-        if rc != 0:
-            raise RuntimeError("write_batch failed")
-        t1 = time.time()
-        bw = total / 1024 / 1024 / (t1 - t0)
-        print(f"[Save] done in {t1-t0:.3f}s, BW={bw:.1f} MB/s")
+    def _collect_checksums(self, layout, plans):
+        """写完成后取出每个 chunk 的 CRC，按参数分组；plans 为按布局顺序排列的 (plan, chunk 数)"""
+        if not self.checksum:
+            return None
+        values = []
+        for plan, num in plans:
+            crcs = (ctypes.c_uint32 * num)()
+            if lib.npu_nvme_plan_get_checksums(plan, crcs) != 0:
+                raise RuntimeError("npu_nvme_plan_get_checksums failed")
+            values.extend(crcs)
+        out, i = {}, 0
+        for p in layout:
+            n = chunk_count(p["size"], self.chunk_size)
+            out[p["name"]] = values[i:i + n]
+            i += n
+        return out
 
-        # 保存元数据
+    def _write_meta(self, layout, total, meta_path, crcs=None, zero_manifest=False):
         meta = {
             "chunk_size": self.chunk_size,
             "total_size": total,
+            "compression": self.compression,
+            "zero_manifest": zero_manifest,
+            **({"tenant": self.tenant, "space_version": self._space_ext.version}
+               if self._space_ext is not None else {}),
             "params": {p["name"]: {
                 "offset": p["offset"],
                 "size": p["size"],
                 "shape": p["shape"],
                 "dtype": p["dtype"],
+                "elem": p["elem"],
+                **({"crc32c": crcs[p["name"]]} if crcs else {}),
             } for p in layout}
         }
         torch.save(meta, meta_path)
         self.meta = meta
         print(f"[Save] meta saved to {meta_path}")
-        return total, len(chunks), t1 - t0, bw
 
-    def load(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
-        meta = torch.load(meta_path)
+    # --------------------------------------------------------
+    # 盘上格式
+    # --------------------------------------------------------
+    def _open_ckpt(self):
+        """扫描超级块；第一次在空盘上使用时按 num_slots / slot_size 格式化"""
+        if self._ckpt is None:
+            base, num_slots, slot_size = self._ckpt_args
+            ck = ctypes.c_void_p()
+            if lib.npu_nvme_ckpt_open(self.ctx, base, num_slots, slot_size, ctypes.byref(ck)) != 0:
+                raise RuntimeError("npu_nvme_ckpt_open failed")
+            self._ckpt = ck
+        return self._ckpt
+
+    def _save_device(self, model: torch.nn.Module):
+        self._drain()
+        self._sync_compute()
+        ck = self._open_ckpt()
+        params = self._prepare_params(model)
+        num = len(params)
+        tensors = (NPUNVMETensor * num)()
+        ptrs = (ctypes.c_void_p * num)()
+        for i, p in enumerate(params):
+            if len(p["shape"]) > NPU_NVME_MAX_DIMS:
+                raise ValueError(f"{p['name']}: more than {NPU_NVME_MAX_DIMS} dims")
+            t = tensors[i]
+            t.name = p["name"].encode()[:NPU_NVME_MAX_NAME - 1]
+            t.dtype = p["dtype"].encode()[:NPU_NVME_MAX_DTYPE - 1]
+            t.ndim = len(p["shape"])
+            for d, v in enumerate(p["shape"]):
+                t.shape[d] = v
+            t.size = p["size"]
+            ptrs[i] = p["ptr"]
+        total = sum(p["size"] for p in params)
+
+        t0 = time.time()
+        if lib.npu_nvme_ckpt_save(ck, tensors, ptrs, num) != 0:
+            raise RuntimeError("npu_nvme_ckpt_save failed")
+        t1 = time.time()
+        bw = total / 1024 / 1024 / (t1 - t0)
+        print(f"[Save] generation {lib.npu_nvme_ckpt_generation(ck)} committed on device: "
+              f"params={num}, total={total/1024/1024:.2f}MB, {t1-t0:.3f}s, BW={bw:.1f} MB/s")
+        return total, num, t1 - t0, bw
+
+    def _load_device(self, model: torch.nn.Module):
+        self._drain()
+        self._sync_compute()
+        ck = self._open_ckpt()
+        n = lib.npu_nvme_ckpt_num_tensors(ck)
+        if lib.npu_nvme_ckpt_generation(ck) == 0 or n == 0:
+            raise RuntimeError("no checkpoint on device")
+        found = (NPUNVMETensor * n)()
+        lib.npu_nvme_ckpt_get_tensors(ck, found, n)
+        by_name = {found[i].name.decode(): found[i] for i in range(n)}
+
+        picked = []
+        for name, p in model.named_parameters():
+            t = by_name.get(name)
+            if t is None:
+                continue
+            if t.size != p.numel() * p.element_size():
+                raise RuntimeError(f"{name}: size {t.size} on device, {p.numel() * p.element_size()} in model")
+            picked.append((name, p.data_ptr(), t))
+        num = len(picked)
+        tensors = (NPUNVMETensor * num)(*[t for _, _, t in picked])
+        ptrs = (ctypes.c_void_p * num)(*[ptr for _, ptr, _ in picked])
+        mismatch = (ctypes.c_uint8 * num)()
+        total = sum(t.size for _, _, t in picked)
+
+        t0 = time.time()
+        rc = lib.npu_nvme_ckpt_load(ck, tensors, ptrs, num, mismatch)
+        t1 = time.time()
+        if rc == NPU_NVME_ERR_CHECKSUM:
+            bad = [picked[i][0] for i in range(num) if mismatch[i]]
+            raise RuntimeError(f"checkpoint corrupted: crc32c mismatch in {len(bad)} params, "
+                               f"first 5: {bad[:5]}")
+        if rc != 0:
+            raise RuntimeError("npu_nvme_ckpt_load failed")
+        bw = total / 1024 / 1024 / (t1 - t0)
+        print(f"[Load] generation {lib.npu_nvme_ckpt_generation(ck)} from device: "
+              f"params={num}/{n}, {t1-t0:.3f}s, BW={bw:.1f} MB/s")
+        return total, num, t1 - t0, bw
+
+    def save(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
+        if self.device_format:
+            return self._save_device(model)
+        global_path, meta_path = meta_path, self._rank_path(meta_path)
+        plan, layout, total, num = self._prepare_save(model, meta_path)
+
+        t0 = time.time()
+        rc = lib.npu_nvme_plan_execute_write(plan)
+        if rc != 0:
+            self._abort()
+            raise RuntimeError("write_batch failed")
+        t1 = time.time()
+        bw = total / 1024 / 1024 / (t1 - t0)
+        print(f"[Save] done in {t1-t0:.3f}s, BW={bw:.1f} MB/s")
+
+        # 保存元数据
+        self._report_delta(meta_path)
+        self._write_meta(layout, total, meta_path, self._collect_checksums(layout, [(plan, num)]),
+                         self.zero_detect)
+        self._commit(global_path)
+        return total, num, t1 - t0, bw
+
+    def save_async(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
+        """
+        立即返回 CheckpointFuture，NVMe 写在后台进行，可与下一步前向/反向重叠。
+        完成前不能修改参数（optimizer.step 之前要 wait）。元数据在完成时写出。
+        """
+        if self.device_format:
+            raise NotImplementedError("save_async is not supported with device_format")
+        if self.snapshot_budget:
+            return self._save_snapshot(model, meta_path)
+        global_path, meta_path = meta_path, self._rank_path(meta_path)
+        plan, layout, total, num = self._prepare_save(model, meta_path)
+        h = lib.npu_nvme_plan_execute_write_async(plan, None, None)
+        if not h:
+            raise RuntimeError("write_async submit failed")
+        def on_done():
+            self._report_delta(meta_path)
+            self._write_meta(layout, total, meta_path, self._collect_checksums(layout, [(plan, num)]),
+                             self.zero_detect)
+            self._commit(global_path)
+        self._pending = CheckpointFuture(h, "Save", total, num, on_done=on_done)
+        return self._pending
+
+    def _save_snapshot(self, model: torch.nn.Module, meta_path: str):
+        """
+        快照后排空：参数按布局顺序 D2D 拷进暂存区，从第一个放不下的参数起当场直接写盘，
+        返回时参数即可更新（future.stall 为这段时间，含开头等上一次 checkpoint 与计算 stream）；
+        暂存的部分在后台写盘，future 完成时写出元数据，其时间只含后台排空。
+        """
+        t0 = time.monotonic()
+        self._drain()
+        self._sync_compute()
+        tw = time.monotonic()
+        global_path, meta_path = meta_path, self._rank_path(meta_path)
+        params = self._prepare_params(model)
+        sizes = [p["size"] for p in params]
+        _, span = layout_tensors(sizes, 0)
+        base = self._place(span)
+        offsets, total = layout_tensors(sizes, base)
+        layout = [{**p, "offset": off} for p, off in zip(params, offsets)]
+        if self._snap is None:
+            self._snap = lib.npu_nvme_snapshot_create(self.ctx, self.snapshot_budget)
+            if not self._snap:
+                raise RuntimeError("npu_nvme_snapshot_create failed")
+
+        num = len(params)
+        c_staged = (ctypes.c_void_p * num)()
+        k = lib.npu_nvme_snapshot_take(self._snap,
+                                       (ctypes.c_void_p * num)(*[p["ptr"] for p in params]),
+                                       (ctypes.c_size_t * num)(*sizes), num, c_staged)
+        if k < 0:
+            self._abort()
+            raise RuntimeError("npu_nvme_snapshot_take failed")
+        t1 = time.monotonic()
+
+        # 暂存区地址只取决于大小，布局与参数地址不变时两个计划都可以复用
+        key = (self.chunk_size, base, tuple((p["ptr"], p["size"]) for p in params), k)
+        if self._snap_plans is None or self._snap_plans[0] != key:
+            for plan, _ in (self._snap_plans[1] if self._snap_plans else []):
+                lib.npu_nvme_plan_destroy(plan)
+            plans = []
+            for ptrs, lo, hi in ((list(c_staged[:k]), 0, k),
+                                 ([p["ptr"] for p in params[k:]], k, num)):
+                if lo == hi:
+                    continue
+                plan, n = create_tensor_plan(self.ctx, ptrs, offsets[lo:hi], sizes[lo:hi],
+                                             self.chunk_size)
+                if self.checksum and lib.npu_nvme_plan_set_checksum(plan, True) != 0:
+                    raise RuntimeError("npu_nvme_plan_set_checksum failed")
+                plans.append((plan, n))
+            self._snap_plans = (key, plans)
+        plans = self._snap_plans[1]
+        staged = plans[0] if k > 0 else None
+        direct = plans[-1] if k < num else None
+
+        if direct is not None and lib.npu_nvme_plan_execute_write(direct[0]) != 0:
+            self._abort()
+            raise RuntimeError("write_batch failed")
+        t2 = time.monotonic()
+        staged_bytes = sum(sizes[:k])
+        print(f"[Save] snapshot: {k}/{num} params staged ({staged_bytes/1024/1024:.2f}MB), "
+              f"stall {t2-t0:.3f}s (wait {tw-t0:.3f}s, copy {t1-tw:.3f}s, "
+              f"direct write {t2-t1:.3f}s)")
+
+        def on_done():
+            self._write_meta(layout, total, meta_path, self._collect_checksums(layout, plans))
+            self._commit(global_path)
+        if staged is None:
+            # 暂存区一个参数都放不下：已全部直接写完，返回一个已完成的 future
+            fut = CheckpointFuture(None, "Save", total, sum(n for _, n in plans))
+            on_done()
+            fut._result = (total, fut._num, t2 - t0, total / 1024 / 1024 / max(t2 - t0, 1e-9))
+        else:
+            h = lib.npu_nvme_plan_execute_write_async(staged[0], None, None)
+            if not h:
+                raise RuntimeError("write_async submit failed")
+            fut = CheckpointFuture(h, "Save", total, sum(n for _, n in plans), on_done=on_done)
+        fut.stall = t2 - t0
+        self._pending = fut
+        return fut
+
+    def _prepare_load(self, model: torch.nn.Module, meta_path: str):
+        self._drain()
+        self._sync_compute()
+        meta = self._load_meta(meta_path)
+        meta_path = self._rank_path(meta_path)
         chunk_size = min(meta.get("chunk_size", self.chunk_size), self.chunk_size)
         self.meta = meta
+        # 空间管理下保存的版本可能已被 keep_versions 回收，读出来的会是别的数据
+        if self._space and "space_version" in meta:
+            ext = NPUNVMEExtent()
+            if lib.npu_nvme_space_find(self._space, meta["tenant"].encode(),
+                                       meta["space_version"], ctypes.byref(ext)) != 0:
+                raise RuntimeError(f"{meta_path}: version {meta['space_version']} of "
+                                   f"{meta['tenant']} is no longer on the device")
 
-        chunks = rebuild_chunks_from_meta(model, meta["params"], chunk_size)
-        num = len(chunks)
-        c_ptrs = (ctypes.c_void_p * num)()
-        c_offs = (ctypes.c_uint64 * num)()
-        c_sizes = (ctypes.c_size_t * num)()
-        for i, (p, o, s) in enumerate(chunks):
-            c_ptrs[i] = p
-            c_offs[i] = o
-            c_sizes[i] = s
+        key = (chunk_size, tuple(
+            (name, p.data_ptr(), meta["params"][name]["offset"], meta["params"][name]["size"])
+            for name, p in model.named_parameters() if name in meta["params"]))
+        if self._load_plan is None or self._load_plan[0] != key:
+            # 按 offset 排序，与写入时的 chunk 顺序一致
+            params = dict(model.named_parameters())
+            names = sorted((n for n in params if n in meta["params"]),
+                           key=lambda n: meta["params"][n]["offset"])
+            info = [meta["params"][n] for n in names]
+            plan, num = create_tensor_plan(self.ctx, [params[n].data_ptr() for n in names],
+                                           [i["offset"] for i in info], [i["size"] for i in info],
+                                           chunk_size)
+            compression = meta.get("compression")
+            if compression:
+                set_plan_compression(plan, compression, chunk_elem_sizes(info, chunk_size))
+            if self._load_plan is not None:
+                lib.npu_nvme_plan_destroy(self._load_plan[1])
+            self._load_plan = (key, plan, num)
+        _, plan, num = self._load_plan
+        self._set_expected(plan, model, meta, chunk_size, num)
+        # 压缩长度与全零标记每次保存都会变，读前总是重新加载清单
+        manifest = (meta_path + ".manifest").encode()
+        if meta.get("compression"):
+            if lib.npu_nvme_plan_load_manifest(plan, manifest) != 0:
+                raise RuntimeError(f"cannot load {meta_path}.manifest for compressed checkpoint")
+        # 全零标记只是优化（盘上本来就是 0）：chunk 切法不同或清单不可用时照常读盘
+        zeros = meta.get("zero_manifest", False) and chunk_size == meta.get("chunk_size")
+        lib.npu_nvme_plan_set_zero_detect(plan, False)
+        if zeros:
+            lib.npu_nvme_plan_set_zero_detect(plan, True)
+            if lib.npu_nvme_plan_load_manifest(plan, manifest) != 0:
+                lib.npu_nvme_plan_set_zero_detect(plan, False)
+        return plan, meta["total_size"], num
 
-        t0 = time.time()
-        rc = lib.npu_nvme_read_batch(self.ctx, c_ptrs, c_offs, c_sizes, num)
+    def _set_expected(self, plan, model, meta, chunk_size, num):
+        """按读计划的 chunk 顺序（offset 升序）摆好期望 CRC；chunk 切法不同或旧元数据时不校验"""
+        self._load_names = None
+        names = sorted((n for n, _ in model.named_parameters() if n in meta["params"]),
+                       key=lambda n: meta["params"][n]["offset"])
+        usable = (self.checksum and chunk_size == meta.get("chunk_size")
+                  and all("crc32c" in meta["params"][n] for n in names))
+        if not usable:
+            lib.npu_nvme_plan_set_expected_checksums(plan, None)
+            return
+        expected = [c for n in names for c in meta["params"][n]["crc32c"]]
+        if len(expected) != num:
+            raise RuntimeError("checksum count does not match load plan")
+        c_expected = (ctypes.c_uint32 * num)(*expected)
+        if lib.npu_nvme_plan_set_expected_checksums(plan, c_expected) != 0:
+            raise RuntimeError("npu_nvme_plan_set_expected_checksums failed")
+        self._load_names = [n for n in names
+                            for _ in range(chunk_count(meta["params"][n]["size"], chunk_size))]
+
+    def _check_read(self, rc):
+        if rc == NPU_NVME_ERR_CHECKSUM:
+            plan, num = self._load_plan[1], self._load_plan[2]
+            flags = (ctypes.c_uint8 * num)()
+            lib.npu_nvme_plan_get_mismatches(plan, flags)
+            bad = sorted({self._load_names[i] for i in range(num) if flags[i]})
+            raise RuntimeError(f"checkpoint corrupted: crc32c mismatch in {len(bad)} params, "
+                               f"first 5: {bad[:5]}")
         if rc != 0:
             raise RuntimeError("read_batch failed")
+
+    def load(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
+        if self.device_format:
+            return self._load_device(model)
+        plan, total, num = self._prepare_load(model, meta_path)
+
+        t0 = time.time()
+        rc = lib.npu_nvme_plan_execute_read(plan)
+        self._check_read(rc)
         t1 = time.time()
-        total = meta["total_size"]
         bw = total / 1024 / 1024 / (t1 - t0)
         print(f"[Load] done in {t1-t0:.3f}s, BW={bw:.1f} MB/s")
-        return total, len(chunks), t1 - t0, bw
+        return total, num, t1 - t0, bw
+
+    def load_stream(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt",
+                    order: List[str] = None):
+        """
+        优先级流式恢复，立即返回 StreamingLoad。order 为参数名的读取顺序（未列出的参数
+        按 model.named_parameters() 顺序排在后面），默认即 named_parameters() 顺序，
+        embedding 与前几层先到，可以先开始算。不经读计划，不比对 CRC32C，不支持压缩。
+        """
+        if self.device_format:
+            raise NotImplementedError("load_stream is not supported with device_format")
+        self._drain()
+        self._sync_compute()
+        meta = self._load_meta(meta_path)
+        if meta.get("compression"):
+            raise NotImplementedError("load_stream does not support compressed checkpoints")
+        info = meta["params"]
+
+        names = [n for n, _ in model.named_parameters() if n in info]
+        first = [n for n in (order or []) if n in info]
+        rank = {n: i for i, n in enumerate(first)}
+        names.sort(key=lambda n: rank.get(n, len(rank)))   # 稳定排序，未列出的保持原顺序
+
+        # 每个参数一个 item，超过单条命令的由 C 侧拆开；优先级即在 names 中的位置
+        params = dict(model.named_parameters())
+        num = len(names)
+        if num == 0:
+            raise RuntimeError(f"no parameters of the model found in {meta_path}")
+        sizes = [info[n]["size"] for n in names]
+        h = lib.npu_nvme_read_stream(self.ctx,
+                                     (ctypes.c_void_p * num)(*[params[n].data_ptr() for n in names]),
+                                     (ctypes.c_uint64 * num)(*[info[n]["offset"] for n in names]),
+                                     (ctypes.c_size_t * num)(*sizes),
+                                     num,
+                                     (ctypes.c_int * num)(*range(num)),
+                                     None, None, None, None)
+        if not h:
+            raise RuntimeError("read_stream submit failed")
+        self._pending = StreamingLoad(h, sum(sizes), names)
+        return self._pending
+
+    def load_async(self, model: torch.nn.Module, meta_path: str = "checkpoint_meta.pt"):
+        """立即返回 CheckpointFuture；完成前不能使用模型参数"""
+        if self.device_format:
+            raise NotImplementedError("load_async is not supported with device_format")
+        plan, total, num = self._prepare_load(model, meta_path)
+        h = lib.npu_nvme_plan_execute_read_async(plan, None, None)
+        if not h:
+            raise RuntimeError("read_async submit failed")
+        self._pending = CheckpointFuture(h, "Load", total, num, check=self._check_read)
+        return self._pending
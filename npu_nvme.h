@@ -10,23 +10,217 @@ extern "C" {
 #endif
 
 typedef struct npu_nvme_context npu_nvme_context_t;
+typedef struct npu_nvme_plan npu_nvme_plan_t;
+typedef struct npu_nvme_handle npu_nvme_handle_t;
 
+/* npu_nvme_poll / npu_nvme_wait 的返回值：任务尚未完成 */
+#define NPU_NVME_PENDING 1
 
+/* 读回数据的 CRC32C 与期望值不一致（传输本身成功） */
+#define NPU_NVME_ERR_CHECKSUM (-2)
+
+/* 空间管理：没有足够大的连续空闲区间 */
+#define NPU_NVME_ERR_NOSPACE (-3)
+
+/* 异步任务完成回调，在进度线程中调用，status 为 0 成功、<0 失败。
+ * 回调里不能释放 handle，也不能调用会等待的 npu_nvme_* 接口。 */
+typedef void (*npu_nvme_callback_t)(npu_nvme_handle_t *h, int status, void *arg);
+
+/* 流式读中单个 item 就绪回调：item 的数据已全部上传到 NPU（status 0）或失败（<0）。
+ * 在 worker 线程中调用，应尽快返回；其余限制同 npu_nvme_callback_t */
+typedef void (*npu_nvme_ready_cb_t)(npu_nvme_handle_t *h, int item, int status, void *arg);
+
+
+/* num_workers: I/O qpair 数量。1 为单线程模式（在调用线程内完成拷贝、提交与轮询）；
+ * >1 时每个 qpair 一个绑核 worker 线程，各自拥有 pipeline_depth 个 DMA buffer，
+ * batch 按字节数切成连续区间分给各 worker，批量接口不变。
+ * pipeline_depth 即 npu_nvme_opts_t 的 queue_depth，chunk_size 为单条命令上限（0 取 MDTS）。 */
 int npu_nvme_init(npu_nvme_context_t **ctx,
                   const char *nvme_pci_addr,
                   int npu_device_id,
                   int pipeline_depth,
                   size_t chunk_size,
+                  int num_workers,
                   bool enable_profiling);
 
+/* 多个 NVMe 控制器做 RAID-0 条带：nvme_pci_addrs[0..num_devices) 各取第一个活动命名空间，
+ * 逻辑偏移 L 落在设备 (L / stripe_unit) % num_devices，跨条带边界的 item 会被拆成多条命令。
+ * stripe_unit 为 0 时取 4K 对齐后的 chunk_size（chunk_size 为 0 时取 MDTS），必须是 4KB 与块大小的整数倍；
+ * 各设备块大小必须一致，max_transfer 取最小 MDTS。
+ * num_workers 为每个设备的 worker 数，总 worker 数 = num_devices * num_workers。
+ * 批量读写接口不变，nvme_offsets 解释为逻辑偏移。 */
+int npu_nvme_init_striped(npu_nvme_context_t **ctx,
+                          const char **nvme_pci_addrs,
+                          int num_devices,
+                          size_t stripe_unit,
+                          int npu_device_id,
+                          int pipeline_depth,
+                          size_t chunk_size,
+                          int num_workers,
+                          bool enable_profiling);
+
+/* 只剩 NVMe 命令在途时 worker 的等待方式 */
+typedef enum npu_nvme_poll_mode {
+    NPU_NVME_POLL_ADAPTIVE = 0, /* 按近期单条命令服务时间预测完成时刻：离得远就睡，临近再自旋 */
+    NPU_NVME_POLL_SPIN,         /* 一直轮询，延迟最低，占满一个核 */
+    NPU_NVME_POLL_SLEEP,        /* 每轮 usleep(50) */
+} npu_nvme_poll_mode_t;
+
+/* DMA slab 的分配方式。ACL 只对注册过的主机内存直接 DMA，
+ * 未注册（可分页）的内存每次 D2H/H2D 都要经运行时内部的暂存区多拷一遍 */
+typedef enum npu_nvme_dma_policy {
+    NPU_NVME_DMA_SPDK_REGISTERED = 0, /* SPDK 大页 + aclrtHostRegister（默认），注册失败退回 PAGEABLE */
+    NPU_NVME_DMA_ACL_HOST,            /* aclrtMallocHost 分配，按 2MB 对齐后 spdk_mem_register */
+    NPU_NVME_DMA_PAGEABLE,            /* 只用 spdk_dma_zmalloc，不向 ACL 注册 */
+} npu_nvme_dma_policy_t;
+
+/* 完整的初始化参数。DMA buffer 从一块大页 slab 中切出，单条命令的长度与
+ * buffer 数量分开配置：queue_depth 决定每个 qpair 的在途命令数（= buffer 数），
+ * dma_mem_bytes 决定 slab 大小，放不下 queue_depth 条 chunk_size 的命令时缩小单条命令。
+ * 任意大小的 item 都会被切成不超过单条命令长度的多条命令。 */
+typedef struct npu_nvme_opts {
+    const char **nvme_pci_addrs;
+    int    num_devices;
+    size_t stripe_unit;      /* 0 取单条命令上限（chunk_size 或 MDTS） */
+    int    npu_device_id;
+    int    queue_depth;      /* 每个 worker 的在途命令数，1..256 */
+    size_t chunk_size;       /* 单条命令上限，0 取设备 MDTS */
+    size_t dma_mem_bytes;    /* 所有 worker 合计的 DMA 内存，0 取每 worker min(queue_depth, 16) 条命令 */
+    int    num_workers;      /* 每个设备的 worker 数 */
+    bool   enable_profiling;
+    int    poll_mode;        /* npu_nvme_poll_mode_t，默认 ADAPTIVE */
+    int    shm_id;           /* SPDK 多进程共享内存 id：同一节点上各 rank 取相同值即可共用控制器
+                                （各自的 qpair），-1 为独占（默认）。一个进程内只能用一个值 */
+    int    dma_policy;       /* npu_nvme_dma_policy_t，默认 SPDK_REGISTERED */
+    int    numa_node;        /* DMA slab 与 worker/进度线程所在的 NUMA 节点：NPU_NVME_NUMA_AUTO（默认）
+                                取第一个控制器的节点、未知时取 NPU 的节点；>= 0 指定；NPU_NVME_NUMA_OFF 不区分 */
+    const char *npu_pci_addr; /* NPU 的 PCI 地址，仅用于查它的 NUMA 节点，可为 NULL */
+    size_t host_cache_bytes; /* 主机恢复缓存的上限，0 关闭（默认），见 npu_nvme_get_cache_info */
+} npu_nvme_opts_t;
+
+#define NPU_NVME_NUMA_AUTO  (-1)
+#define NPU_NVME_NUMA_OFF   (-2)
+
+/* 填默认值：单设备、queue_depth 4、chunk_size 0、1 个 worker、shm_id -1、numa_node AUTO */
+void npu_nvme_opts_init(npu_nvme_opts_t *opts);
+
+int npu_nvme_init_opts(npu_nvme_context_t **ctx, const npu_nvme_opts_t *opts);
+
 void npu_nvme_cleanup(npu_nvme_context_t *ctx);
 
+/* 单条 NVMe 命令（一个 DMA buffer）的长度 */
 size_t npu_nvme_get_max_transfer(npu_nvme_context_t *ctx);
 
+int npu_nvme_get_queue_depth(npu_nvme_context_t *ctx);
+
+int npu_nvme_get_num_workers(npu_nvme_context_t *ctx);
+
+/* 切换轮询方式，从下一个批次起生效 */
+int npu_nvme_set_poll_mode(npu_nvme_context_t *ctx, int mode);
+
+/* 实际生效的 DMA 分配方式（SPDK_REGISTERED 注册失败时为 PAGEABLE） */
+int npu_nvme_get_dma_policy(npu_nvme_context_t *ctx);
+
+/* 实际使用的 NUMA 节点，-1 表示未按节点放置 */
+int npu_nvme_get_numa_node(npu_nvme_context_t *ctx);
+
+/* 主机恢复缓存：host_cache_bytes 非 0 时，写流水线把 D2H 后（压缩前）的每个 segment 复制一份
+ * 留在大页内存里，按 (设备, 设备偏移, 长度) 索引，超过上限按 LRU 淘汰。之后位置与切法相同的读
+ * 直接从缓存 H2D，不读盘；其余照常读盘。写批次开始时与它重叠的旧条目全部作废，
+ * 所以回滚到最近一次写的 checkpoint 只需一遍 H2D。每个条目占一个单条命令长度的槽。
+ * 自动调优的试验与 checkpoint 元数据读写不放入也不命中缓存（写仍作废重叠条目）。
+ * 只对本进程的写有效：其它进程（如别的 rank）改过盘上同一区域后需先 npu_nvme_cache_clear。 */
+typedef struct npu_nvme_cache_info {
+    size_t   capacity;    /* 槽数 x 单条命令长度，0 表示未打开 */
+    size_t   used;        /* 已占用的槽 x 单条命令长度 */
+    uint64_t generation;  /* 写批次号，每个条目记着填入它的批次 */
+    uint64_t evictions;   /* LRU 淘汰的条目数 */
+    bool     hugetlb;     /* 来自 hugetlbfs 大页（否则为透明大页） */
+} npu_nvme_cache_info_t;
+
+int npu_nvme_get_cache_info(npu_nvme_context_t *ctx, npu_nvme_cache_info_t *out);
+
+/* 丢弃缓存中的全部条目 */
+void npu_nvme_cache_clear(npu_nvme_context_t *ctx);
+
+/* 自动调优结果：读写分别的在途命令数与单条命令长度，mbps 为 0 表示未调优 */
+typedef struct npu_nvme_tune {
+    int    write_depth;
+    size_t write_chunk;
+    double write_mbps;
+    int    read_depth;
+    size_t read_chunk;
+    double read_mbps;
+} npu_nvme_tune_t;
+
+/* 在 [scratch_offset, scratch_offset + scratch_len)（字节，4K 对齐，内容会被覆盖，最多用 64MB）
+ * 上用短时读写扫描在途命令数（1,2,4..queue_depth）与单条命令长度（32KB..max_transfer），
+ * 读写分别取最快的组合并立即生效，总耗时约 budget_ms。
+ * 结果按各设备的序列号/型号与每设备 worker 数写入缓存文件（环境变量 NPU_NVME_TUNE_CACHE，
+ * 默认 $HOME/.npu_nvme_tune，设为空串则不缓存），之后相同配置的 init 直接套用。
+ * 只改变命令的切分与并发，不改变盘上布局；计划在创建时按写的设置切分，读写共用。
+ * 不能与其它读写同时调用。 */
+int npu_nvme_autotune(npu_nvme_context_t *ctx, uint64_t scratch_offset, uint64_t scratch_len,
+                      uint32_t budget_ms, npu_nvme_tune_t *out);
+
+/* 当前生效的读写设置（init 时来自缓存，否则为 queue_depth / max_transfer） */
+int npu_nvme_get_tune(npu_nvme_context_t *ctx, npu_nvme_tune_t *out);
+
+/* =========================
+ * 统计：始终开启，各 worker 在热路径上只做 CLOCK_MONOTONIC_RAW 取时与直方图计数。
+ * 直方图为 HDR 式对数分桶（单位 ns）：小于 16 的值各占一桶，之后每个 2 的幂区间
+ * 均分 16 桶（相对误差约 6%），最大约 2^43 ns，更大的值记在最后一桶。
+ * ========================= */
+#define NPU_NVME_HIST_BUCKETS 640
+
+typedef struct npu_nvme_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[NPU_NVME_HIST_BUCKETS];
+} npu_nvme_hist_t;
+
+/* 每条命令（segment）的各阶段耗时 */
+enum {
+    NPU_NVME_STAGE_COPY = 0,   /* NPU<->Host 拷贝：发起到事件完成 */
+    NPU_NVME_STAGE_NVME,       /* NVMe 服务时间：提交到完成回调 */
+    NPU_NVME_STAGE_QUEUE,      /* 排队：批次开始到拿到 buffer/深度名额开始处理 */
+    NPU_NVME_STAGE_E2E,        /* 端到端：批次开始到该命令的数据全部就位 */
+    NPU_NVME_NUM_STAGES
+};
+
+typedef struct npu_nvme_dir_stats {
+    uint64_t batches;
+    uint64_t commands;         /* 完成的命令数（含增量跳过的） */
+    uint64_t bytes;            /* 命令覆盖的字节数（4K 对齐、压缩前） */
+    uint64_t errors;           /* 失败的命令数 */
+    uint64_t cache_hits;       /* 读：由主机缓存供数、没有读盘的命令数（写方向为 0） */
+    uint64_t cache_bytes;      /* 命中命令覆盖的字节数 */
+    uint64_t cache_fills;      /* 写：复制进主机缓存的命令数（读方向为 0） */
+    uint64_t cache_fill_bytes; /* 复制进缓存的字节数 */
+    npu_nvme_hist_t hist[NPU_NVME_NUM_STAGES];
+} npu_nvme_dir_stats_t;
+
+typedef struct npu_nvme_stats {
+    npu_nvme_dir_stats_t write;
+    npu_nvme_dir_stats_t read;
+    uint64_t trims;            /* 空间管理回收时完成的 Deallocate 命令数，不计入 write */
+} npu_nvme_stats_t;
+
+/* 上次 reset 以来的累计值（各 worker 合并）；可在读写进行中调用 */
+int npu_nvme_get_stats(npu_nvme_context_t *ctx, npu_nvme_stats_t *out);
+
+/* 以当前累计值为新起点，不影响在途读写 */
+void npu_nvme_reset_stats(npu_nvme_context_t *ctx);
+
+/* 直方图的百分位（pct 取 0~100，如 99.9），返回所在桶的中点（ns），空直方图返回 0 */
+uint64_t npu_nvme_hist_percentile(const npu_nvme_hist_t *h, double pct);
+
+int npu_nvme_get_num_devices(npu_nvme_context_t *ctx);
+
 /* 批量写：将 chunks 写到 NVMe
  * npu_ptrs[i]: NPU 端地址（起始指针，已含 chunk 内偏移）
  * nvme_offsets[i]: NVMe 字节偏移
- * sizes[i]: 本次要写的大小（不超过 max_transfer）
+ * sizes[i]: 本次要写的大小，超过 max_transfer 时自动拆成多条命令
  * 返回 0 成功，<0 失败
  */
 int npu_nvme_write_batch(npu_nvme_context_t *ctx,
@@ -42,6 +236,351 @@ int npu_nvme_read_batch(npu_nvme_context_t *ctx,
                         size_t *sizes,
                         int num_items);
 
+/* 带 CRC32C 校验的批量读写：worker 在 host DMA buffer 里就地计算
+ * （x86 SSE4.2 / ARMv8 CRC 指令，否则 slice-by-8），与 NVMe 传输流水重叠。
+ * 写：crcs[i] 输出 item i 实际数据（不含 4K 填充）的 CRC32C，由调用方保存。
+ * 读：与 expected_crcs 逐 item 比对，mismatch 非空时填 0/1；
+ *     有不一致的 item 返回 NPU_NVME_ERR_CHECKSUM。 */
+int npu_nvme_write_batch_crc(npu_nvme_context_t *ctx,
+                             void **npu_ptrs,
+                             uint64_t *nvme_offsets,
+                             size_t *sizes,
+                             int num_items,
+                             uint32_t *crcs);
+
+int npu_nvme_read_batch_crc(npu_nvme_context_t *ctx,
+                            void **npu_ptrs,
+                            uint64_t *nvme_offsets,
+                            size_t *sizes,
+                            int num_items,
+                            const uint32_t *expected_crcs,
+                            uint8_t *mismatch);
+
+/* 传输计划：布局不变的重复 checkpoint 只需创建一次。
+ * 创建时完成校验（大小、对齐、容量）、条带切分、worker 分区并预分配全部状态，
+ * 任一 item 非法则返回 NULL；之后每次 execute 不做任何分配。
+ * 参数数组在创建时被复制，调用方可立即释放。计划不能跨 ctx 使用，
+ * 必须在 npu_nvme_cleanup 之前销毁。 */
+npu_nvme_plan_t *npu_nvme_plan_create(npu_nvme_context_t *ctx,
+                                      void **npu_ptrs,
+                                      uint64_t *nvme_offsets,
+                                      size_t *sizes,
+                                      int num_items);
+
+int npu_nvme_plan_execute_write(npu_nvme_plan_t *plan);
+
+int npu_nvme_plan_execute_read(npu_nvme_plan_t *plan);
+
+void npu_nvme_plan_destroy(npu_nvme_plan_t *plan);
+
+/* 张量列表：调用方只给每个张量的 NPU 地址与大小，4K 布局、分块与偏移都在 C 侧完成。
+ * 张量按顺序从 base_offset 起 4K 对齐紧密排列，out_offsets[i] 为张量 i 的盘上偏移（可为 NULL），
+ * 返回总跨度（字节）。 */
+uint64_t npu_nvme_layout_tensors(const size_t *sizes, int num_tensors, uint64_t base_offset,
+                                 uint64_t *out_offsets);
+
+/* 按张量创建计划：每个张量切成不超过 chunk_size（4K 整数倍，0 表示不切）的 item，
+ * item 顺序为张量顺序、张量内从前到后，CRC/压缩/增量都按 item 计。*num_items 返回 item 数 */
+npu_nvme_plan_t *npu_nvme_plan_create_tensors(npu_nvme_context_t *ctx,
+                                              void **npu_ptrs,
+                                              const uint64_t *nvme_offsets,
+                                              const size_t *sizes,
+                                              int num_tensors,
+                                              size_t chunk_size,
+                                              int *num_items);
+
+/* 一次性保存/读回张量列表：按 npu_nvme_layout_tensors 的布局写入；
+ * 读时 nvme_offsets 为 NULL 表示按同样的布局从 base_offset 计算 */
+int npu_nvme_save_tensors(npu_nvme_context_t *ctx,
+                          void **npu_ptrs,
+                          const size_t *sizes,
+                          int num_tensors,
+                          uint64_t base_offset,
+                          uint64_t *out_offsets);
+
+int npu_nvme_load_tensors(npu_nvme_context_t *ctx,
+                          void **npu_ptrs,
+                          const size_t *sizes,
+                          int num_tensors,
+                          uint64_t base_offset,
+                          const uint64_t *nvme_offsets);
+
+/* 增量写：打开后计划的每次写都在 host buffer 里为每个 segment 计算 XXH64 指纹，
+ * 与上次成功写入的指纹相同就跳过该 segment 的 NVMe 写（数据原地不动）。
+ * 指纹表即清单，记录每个 segment 最后一次真正写盘的代号（version）。
+ * 关闭时丢弃指纹表，下一次打开后的第一次写是全量写。 */
+int npu_nvme_plan_set_incremental(npu_nvme_plan_t *plan, bool enable);
+
+/* 最近一次增量写实际写入 / 跳过的字节数（按 4K 对齐后的设备长度） */
+int npu_nvme_plan_get_delta_stats(npu_nvme_plan_t *plan,
+                                  uint64_t *written_bytes,
+                                  uint64_t *skipped_bytes);
+
+/* 压缩：写时每个 segment 在 D2H 之后按元素大小做 byte shuffle 再 LZ4 压缩，
+ * 至少省下一个块时只写压缩后的块（仍从 segment 原偏移开始，不挪动其余数据），
+ * 否则原样写；读时只读压缩部分，解压后再 H2D。
+ * elem_sizes[i] 为 item i 的元素字节数（bf16/fp16 为 2，fp32 为 4），NULL 表示不 shuffle。
+ * 每个 segment 的压缩长度记在清单里：在另一个计划（例如新进程）中读回时，
+ * 先对同布局的计划打开压缩，再 npu_nvme_plan_load_manifest。 */
+#define NPU_NVME_CODEC_NONE 0
+#define NPU_NVME_CODEC_LZ4  1
+int npu_nvme_plan_set_compression(npu_nvme_plan_t *plan, int codec, const int *elem_sizes);
+
+/* 最近一次写的原始 / 实际落盘字节数（跳过的 segment 不计） */
+int npu_nvme_plan_get_compress_stats(npu_nvme_plan_t *plan,
+                                     uint64_t *raw_bytes,
+                                     uint64_t *stored_bytes);
+
+/* 全零检测：打开后计划的每次写都在 D2H 之后扫描 host buffer，全零的 segment 不传数据，
+ * 改发 Deallocate（设备保证释放后读出 0 时）或 Write Zeroes，都不支持时照常写。
+ * 全零标记记在清单里，之后的读跳过这些 segment，直接 aclrtMemset 清零 NPU 内存。
+ * 在另一个计划中读回时，先打开检测再 npu_nvme_plan_load_manifest；没有标记时照常读盘。 */
+int npu_nvme_plan_set_zero_detect(npu_nvme_plan_t *plan, bool enable);
+
+/* 最近一次写中全零 segment 的字节数（按 4K 对齐后的设备长度） */
+int npu_nvme_plan_get_zero_stats(npu_nvme_plan_t *plan, uint64_t *zero_bytes);
+
+/* 校验：打开后计划的每次读写都计算每个 item 的 CRC32C，
+ * 执行完成后用 npu_nvme_plan_get_checksums 取出（num_items 个）。
+ * 设置了期望值（复制一份，NULL 取消比对，设置即打开校验）时，读完逐 item 比对，
+ * 有不一致返回 NPU_NVME_ERR_CHECKSUM，npu_nvme_plan_get_mismatches 返回不一致的个数
+ * 并可填出每个 item 的 0/1 标记。 */
+int npu_nvme_plan_set_checksum(npu_nvme_plan_t *plan, bool enable);
+int npu_nvme_plan_get_checksums(npu_nvme_plan_t *plan, uint32_t *crcs);
+int npu_nvme_plan_set_expected_checksums(npu_nvme_plan_t *plan, const uint32_t *crcs);
+int npu_nvme_plan_get_mismatches(npu_nvme_plan_t *plan, uint8_t *mismatch);
+
+/* 清单持久化（文本），包含增量指纹、压缩长度与全零标记，便于进程重启后继续增量或读回压缩数据；
+ * 加载时布局必须与计划一致 */
+int npu_nvme_plan_save_manifest(npu_nvme_plan_t *plan, const char *path);
+int npu_nvme_plan_load_manifest(npu_nvme_plan_t *plan, const char *path);
+
+/* 异步读写：立即返回 handle，由内部进度线程（首次提交时启动）按提交顺序执行。
+ * 参数数组在提交时复制；NPU 内存在完成前必须保持有效且（写时）不被修改。
+ * 拷贝走库内部的 stream，与调用方的计算 stream 无序：提交前先同步仍在读写这些内存的 stream。
+ * 进度线程启动后同步接口也排进同一队列，和在途异步任务保持先后顺序。
+ * 提交失败返回 NULL；完成后用 npu_nvme_handle_free 释放。 */
+npu_nvme_handle_t *npu_nvme_write_async(npu_nvme_context_t *ctx,
+                                        void **npu_ptrs,
+                                        uint64_t *nvme_offsets,
+                                        size_t *sizes,
+                                        int num_items,
+                                        npu_nvme_callback_t cb,
+                                        void *cb_arg);
+
+npu_nvme_handle_t *npu_nvme_read_async(npu_nvme_context_t *ctx,
+                                       void **npu_ptrs,
+                                       uint64_t *nvme_offsets,
+                                       size_t *sizes,
+                                       int num_items,
+                                       npu_nvme_callback_t cb,
+                                       void *cb_arg);
+
+/* 计划的异步执行；计划在 handle 完成前不能销毁 */
+npu_nvme_handle_t *npu_nvme_plan_execute_write_async(npu_nvme_plan_t *plan,
+                                                     npu_nvme_callback_t cb,
+                                                     void *cb_arg);
+
+npu_nvme_handle_t *npu_nvme_plan_execute_read_async(npu_nvme_plan_t *plan,
+                                                    npu_nvme_callback_t cb,
+                                                    void *cb_arg);
+
+/* 非阻塞查询：NPU_NVME_PENDING 未完成，0 成功，<0 失败 */
+int npu_nvme_poll(npu_nvme_handle_t *h);
+
+/* 等待完成，timeout_ms < 0 表示一直等；超时返回 NPU_NVME_PENDING */
+int npu_nvme_wait(npu_nvme_handle_t *h, int timeout_ms);
+
+/* 从提交到进度线程上执行完的时间（ns，单调时钟，含排队），与何时 poll/wait 观察到完成无关；
+ * 未完成返回 0 */
+uint64_t npu_nvme_handle_elapsed_ns(npu_nvme_handle_t *h);
+
+/* 释放 handle（未完成时先等待） */
+void npu_nvme_handle_free(npu_nvme_handle_t *h);
+
+/* 优先级流式读：priority[i] 越小越先读（NULL 按 item 下标顺序），同一优先级内按盘上偏移。
+ * 每个设备的 worker 都从最高优先级开始；item 的数据全部到达 NPU 即就绪，
+ * 此时调用 ready_cb（可为 NULL），也可用 npu_nvme_stream_wait 等单个 item，
+ * 不必等整个批次。提交、完成与释放同 npu_nvme_read_async */
+npu_nvme_handle_t *npu_nvme_read_stream(npu_nvme_context_t *ctx,
+                                        void **npu_ptrs,
+                                        uint64_t *nvme_offsets,
+                                        size_t *sizes,
+                                        int num_items,
+                                        const int *priority,
+                                        npu_nvme_ready_cb_t ready_cb,
+                                        void *ready_arg,
+                                        npu_nvme_callback_t cb,
+                                        void *cb_arg);
+
+/* 等流式读的 item 就绪：0 成功，<0 失败，超时返回 NPU_NVME_PENDING（timeout_ms 为 0 即查询，
+ * <0 一直等）。ready_ns 非空时返回就绪时刻（ns，相对本次读开始执行） */
+int npu_nvme_stream_wait(npu_nvme_handle_t *h, int item, int timeout_ms, uint64_t *ready_ns);
+
+/* =========================
+ * 盘上 checkpoint：超级块 + 清单 + 多 slot 轮换
+ * 区域从逻辑偏移 base 开始：
+ *   [base, base + 8K)   两个超级块副本，第 g 代写在 (g % 2) 号
+ *   之后 num_slots 个 slot，每个 slot = 清单（4K 对齐）+ 张量数据
+ * 每次保存写进当前已提交 slot 的下一个，数据与清单 flush 落盘后，
+ * 最后写一次超级块（4KB，单块原子写）提交。保存中途崩溃时旧的超级块与 slot 都不受影响；
+ * 打开时读两个超级块，取校验通过且代号最大的那个，无需文件系统即可开始恢复。
+ * ========================= */
+typedef struct npu_nvme_ckpt npu_nvme_ckpt_t;
+
+#define NPU_NVME_MAX_NAME  256
+#define NPU_NVME_MAX_DTYPE 32
+#define NPU_NVME_MAX_DIMS  8
+
+/* 一个张量的清单项。保存时调用方填 name/dtype/ndim/shape/size，
+ * 库填 offset（在 slot 内的字节偏移）与 crc32c */
+typedef struct npu_nvme_tensor {
+    char     name[NPU_NVME_MAX_NAME];
+    char     dtype[NPU_NVME_MAX_DTYPE];   /* 例如 "torch.bfloat16"，库不解释 */
+    int32_t  ndim;
+    int64_t  shape[NPU_NVME_MAX_DIMS];
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc32c;
+} npu_nvme_tensor_t;
+
+/* 扫描 base 处的超级块。已有格式时 num_slots / slot_size 传 0 沿用盘上的值
+ * （非 0 且不一致则失败）；没有有效超级块时按参数格式化，slot_size 为 0 表示
+ * 把 base 之后的容量平分给各 slot，num_slots 至少为 2。 */
+int npu_nvme_ckpt_open(npu_nvme_context_t *ctx, uint64_t base, int num_slots,
+                       uint64_t slot_size, npu_nvme_ckpt_t **out);
+void npu_nvme_ckpt_close(npu_nvme_ckpt_t *ck);
+
+/* 已提交 checkpoint 的代号（0 表示还没有）与张量数 */
+uint64_t npu_nvme_ckpt_generation(npu_nvme_ckpt_t *ck);
+int npu_nvme_ckpt_num_tensors(npu_nvme_ckpt_t *ck);
+
+/* 复制已提交 checkpoint 的清单，最多 max 项，返回复制的项数 */
+int npu_nvme_ckpt_get_tensors(npu_nvme_ckpt_t *ck, npu_nvme_tensor_t *tensors, int max);
+
+/* 保存一个新 checkpoint 并提交，tensors[i] 的 offset / crc32c 被填写 */
+int npu_nvme_ckpt_save(npu_nvme_ckpt_t *ck, npu_nvme_tensor_t *tensors,
+                       void **npu_ptrs, int num_tensors);
+
+/* 从已提交 checkpoint 读回：tensors 取自 npu_nvme_ckpt_get_tensors（可以是子集），
+ * 读完按清单里的 crc32c 校验，mismatch 非空时逐项填 0/1，不一致返回 NPU_NVME_ERR_CHECKSUM */
+int npu_nvme_ckpt_load(npu_nvme_ckpt_t *ck, const npu_nvme_tensor_t *tensors,
+                       void **npu_ptrs, int num_tensors, uint8_t *mismatch);
+
+/* =========================
+ * 多 rank 分片：同一节点的多个训练进程（各自 init，shm_id 相同）共用一块 SSD。
+ * 从逻辑偏移 table_offset 开始的 1MB 是分片表：
+ *   [0, 8K)      全局清单的两个副本（各 rank 区域），第 e 个 epoch 写在 (e % 2) 号
+ *   [8K, ...)    每个 rank 一个 4KB 报到块
+ * 之后是各 rank 的数据区域，按 rank 顺序首尾相接，各自 1MB 对齐。
+ * 各 rank 通过盘上的报到块交换分片大小并互相等待，不依赖其它通信手段。
+ * ========================= */
+#define NPU_NVME_MAX_RANKS  64
+#define NPU_NVME_SHARD_TABLE_BYTES (1024 * 1024)
+
+typedef struct npu_nvme_shard_layout {
+    uint64_t job_id;
+    uint64_t epoch;
+    int32_t  world_size;
+    uint64_t offset[NPU_NVME_MAX_RANKS];   /* 各 rank 数据区域的逻辑偏移（字节） */
+    uint64_t len[NPU_NVME_MAX_RANKS];      /* 各 rank 数据区域长度（1MB 对齐） */
+    uint64_t shard_bytes[NPU_NVME_MAX_RANKS];
+} npu_nvme_shard_layout_t;
+
+/* 划分区域：rank 报到 shard_bytes，等到全部 world_size 个 rank 都以相同的 (job_id, epoch)
+ * 报到后按 rank 顺序计算互不重叠的区域，填入 layout。
+ * job_id 区分不同的训练任务（盘上旧的报到块不会被误认），epoch 每次划分递增（例如取 step）。
+ * 超过 timeout_ms（<0 一直等）仍有 rank 未报到返回 NPU_NVME_PENDING，区域超出容量返回 -1。 */
+int npu_nvme_shard_plan(npu_nvme_context_t *ctx, uint64_t table_offset, uint64_t job_id,
+                        uint64_t epoch, int rank, int world_size, uint64_t shard_bytes,
+                        int timeout_ms, npu_nvme_shard_layout_t *layout);
+
+/* 本 rank 的数据与清单都已写完后调用：等所有 rank 都提交了同一 epoch，
+ * 再由 rank 0 写全局清单（同一个 epoch 之后才能 plan 下一个）。 */
+int npu_nvme_shard_commit(npu_nvme_context_t *ctx, uint64_t table_offset,
+                          const npu_nvme_shard_layout_t *layout, int rank, int timeout_ms);
+
+/* 读最近一次提交的全局清单，没有返回 -1 */
+int npu_nvme_shard_open(npu_nvme_context_t *ctx, uint64_t table_offset,
+                        npu_nvme_shard_layout_t *layout);
+
+/* =========================
+ * 快照后排空：NPU 上预留一块暂存区，保存时先把参数按顺序 D2D 拷进去，
+ * 拷完训练即可继续更新参数，暂存区再异步写盘（例如对暂存区地址建计划后 *_async）。
+ * 暂存区只有一份：用到它的写完成之前不能再次 take。
+ * ========================= */
+typedef struct npu_nvme_snapshot npu_nvme_snapshot_t;
+
+/* 在 NPU 上预留 budget 字节（向上取 4K），失败返回 NULL */
+npu_nvme_snapshot_t *npu_nvme_snapshot_create(npu_nvme_context_t *ctx, size_t budget);
+void npu_nvme_snapshot_destroy(npu_nvme_snapshot_t *snap);
+
+/* 按顺序把张量拷进暂存区（每个 4K 对齐放置），从第一个放不下的张量起都不拷（前缀快照），
+ * staged_ptrs[i] 返回已拷张量在暂存区里的地址。等拷贝完成后返回已拷的张量数，失败 -1；
+ * 没拷的张量需要调用方在更新参数前直接写盘。
+ * 拷贝在暂存区自己的 stream 上，不与调用方的计算 stream 排序：调用前要先同步
+ * 还在写这些张量的 stream（例如 optimizer.step 所在的 stream） */
+int npu_nvme_snapshot_take(npu_nvme_snapshot_t *snap, void **npu_ptrs, const size_t *sizes,
+                           int num_tensors, void **staged_ptrs);
+
+/* =========================
+ * 空间管理：把命名空间的一段 [base, base+len) 交给库分配，多个任务（tenant）
+ * 的多个 checkpoint 版本共用一块盘而不用手工协调偏移。
+ * 开头 1MB 是元数据（区间表的两个副本，每次修改轮流写），之后按 unit 分块，
+ * 每个版本占一段连续的块（best fit），数据 I/O 保持大而顺序。
+ * 释放的区间在进度线程上发 Deallocate 回收，完成后才能再分配。
+ * 进度线程原本没启动时由回收启动，期间同步读写也经它的队列执行（不在调用线程上）；
+ * 之后每个 space 接口开头收回已完成的回收，都收回且队列空闲时停掉它，回到调用线程执行。
+ * 同一区域只能由一个进程打开；接口不是线程安全的。
+ * ========================= */
+typedef struct npu_nvme_space npu_nvme_space_t;
+
+#define NPU_NVME_MAX_TENANT 48
+#define NPU_NVME_SPACE_META_BYTES (1024 * 1024)
+
+/* 一个已分配的版本。offset 是逻辑字节偏移，可直接作为 nvme_offset 使用 */
+typedef struct npu_nvme_extent {
+    char     tenant[NPU_NVME_MAX_TENANT];
+    uint64_t version;        /* 全局递增，同一 tenant 内越大越新 */
+    uint64_t offset;
+    uint64_t bytes;          /* 按 unit 向上取整后的长度 */
+    uint32_t committed;      /* 未提交的版本在下次 open 时被回收 */
+} npu_nvme_extent_t;
+
+typedef struct npu_nvme_space_stats {
+    uint64_t total_bytes;    /* 可分配的数据区大小 */
+    uint64_t used_bytes;     /* 已分配（含未提交） */
+    uint64_t reclaiming_bytes;   /* 已释放、Deallocate 尚未完成 */
+    uint64_t largest_free;   /* 当前能分配的最大连续长度 */
+    int32_t  num_extents;
+} npu_nvme_space_stats_t;
+
+/* 打开 base 处的空间。已有格式时 len / unit 传 0 沿用盘上的值（非 0 且不一致则失败）；
+ * 没有有效元数据时格式化：len 为 0 表示到容量末尾，unit 为 0 表示 1MB（4K 的整数倍）。
+ * 上次没提交的版本在这里回收。 */
+int npu_nvme_space_open(npu_nvme_context_t *ctx, uint64_t base, uint64_t len, uint64_t unit,
+                        npu_nvme_space_t **out);
+/* 等在途的回收完成后释放 */
+void npu_nvme_space_close(npu_nvme_space_t *sp);
+
+/* 为 tenant 分配 bytes 字节的连续区间，元数据落盘后填 out（未提交）。
+ * 放不下时先等在途的回收，仍放不下返回 NPU_NVME_ERR_NOSPACE */
+int npu_nvme_space_alloc(npu_nvme_space_t *sp, const char *tenant, uint64_t bytes,
+                         npu_nvme_extent_t *out);
+/* 数据写完后提交 */
+int npu_nvme_space_commit(npu_nvme_space_t *sp, const char *tenant, uint64_t version);
+/* 释放一个版本（提交与否都可以）。块在 Deallocate 完成后才能再分配，见本节开头 */
+int npu_nvme_space_free(npu_nvme_space_t *sp, const char *tenant, uint64_t version);
+/* 只保留 tenant 最新的 keep 个已提交版本，释放其余已提交版本，返回释放的个数 */
+int npu_nvme_space_retain(npu_nvme_space_t *sp, const char *tenant, int keep);
+
+/* 查找版本，version 为 0 表示最新的已提交版本；没有返回 -1 */
+int npu_nvme_space_find(npu_nvme_space_t *sp, const char *tenant, uint64_t version,
+                        npu_nvme_extent_t *out);
+/* 按版本从新到旧复制 tenant（NULL 表示全部）的区间，最多 max 项，返回复制的项数 */
+int npu_nvme_space_list(npu_nvme_space_t *sp, const char *tenant, npu_nvme_extent_t *out, int max);
+int npu_nvme_space_get_stats(npu_nvme_space_t *sp, npu_nvme_space_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
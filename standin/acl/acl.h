@@ -0,0 +1,89 @@
+#ifndef ACL_STANDIN_ACL_H
+#define ACL_STANDIN_ACL_H
+
+/* =========================
+ * ACL stand-in（主机内存模拟）
+ * 只覆盖 npu_nvme 用到的 aclrt* 子集：设备内存即普通主机内存，
+ * 拷贝由每个 stream 的后台线程按可配置的延迟/带宽执行，
+ * 用于在没有 NPU 的机器上测试流水线行为。
+ * ========================= */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int aclError;
+typedef void *aclrtStream;
+typedef void *aclrtEvent;
+
+#define ACL_SUCCESS                 0
+#define ACL_ERROR_INVALID_PARAM     100000
+#define ACL_ERROR_BAD_ALLOC         200000
+
+typedef enum aclrtMemcpyKind {
+    ACL_MEMCPY_HOST_TO_HOST,
+    ACL_MEMCPY_HOST_TO_DEVICE,
+    ACL_MEMCPY_DEVICE_TO_HOST,
+    ACL_MEMCPY_DEVICE_TO_DEVICE,
+} aclrtMemcpyKind;
+
+typedef enum aclrtMemMallocPolicy {
+    ACL_MEM_MALLOC_HUGE_FIRST,
+    ACL_MEM_MALLOC_HUGE_ONLY,
+    ACL_MEM_MALLOC_NORMAL_ONLY,
+} aclrtMemMallocPolicy;
+
+typedef enum aclrtHostRegisterType {
+    ACL_HOST_REGISTER_MAPPED = 0,
+} aclrtHostRegisterType;
+
+typedef enum aclrtEventRecordedStatus {
+    ACL_EVENT_RECORDED_STATUS_NOT_READY = 0,
+    ACL_EVENT_RECORDED_STATUS_COMPLETE = 1,
+} aclrtEventRecordedStatus;
+
+aclError aclInit(const char *configPath);
+aclError aclFinalize(void);
+aclError aclrtSetDevice(int32_t deviceId);
+aclError aclrtResetDevice(int32_t deviceId);
+
+aclError aclrtMalloc(void **devPtr, size_t size, aclrtMemMallocPolicy policy);
+aclError aclrtFree(void *devPtr);
+
+/* 锁页主机内存：aclrtMallocHost 分配的与 aclrtHostRegister 注册过的区间
+ * 在 H2D/D2H 拷贝时直接 DMA，其余主机内存按可分页处理（见下方拷贝模型） */
+aclError aclrtMallocHost(void **hostPtr, size_t size);
+aclError aclrtFreeHost(void *hostPtr);
+aclError aclrtHostRegister(void *ptr, uint64_t size, aclrtHostRegisterType type, void **devPtr);
+aclError aclrtHostUnregister(void *ptr);
+
+aclError aclrtMemset(void *devPtr, size_t maxCount, int32_t value, size_t count);
+aclError aclrtMemcpy(void *dst, size_t destMax, const void *src, size_t count,
+                     aclrtMemcpyKind kind);
+aclError aclrtMemcpyAsync(void *dst, size_t destMax, const void *src, size_t count,
+                          aclrtMemcpyKind kind, aclrtStream stream);
+
+aclError aclrtCreateStream(aclrtStream *stream);
+aclError aclrtDestroyStream(aclrtStream stream);
+aclError aclrtSynchronizeStream(aclrtStream stream);
+
+aclError aclrtCreateEvent(aclrtEvent *event);
+aclError aclrtDestroyEvent(aclrtEvent event);
+aclError aclrtRecordEvent(aclrtEvent event, aclrtStream stream);
+aclError aclrtQueryEventStatus(aclrtEvent event, aclrtEventRecordedStatus *status);
+aclError aclrtSynchronizeEvent(aclrtEvent event);
+
+/* stand-in 专用：设置拷贝模型。每次拷贝耗时 = latency_us + count / bandwidth。
+ * bandwidth_mbps 为 0 表示不限速。也可通过环境变量
+ * ACL_STANDIN_COPY_US / ACL_STANDIN_COPY_MBPS 设置。
+ * 主机侧未锁页的 H2D/D2H 拷贝先经内部暂存区多拷一遍，
+ * 另按 ACL_STANDIN_PAGEABLE_MBPS（默认 0 = 不额外限速）计入这次暂存拷贝的耗时。 */
+void aclStandinSetCopyModel(uint32_t latency_us, uint32_t bandwidth_mbps);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,332 @@
+#include "acl/acl.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* 拷贝模型（所有 stream 共享） */
+static uint32_t g_copy_latency_us = 0;
+static uint32_t g_copy_mbps = 0;
+static uint32_t g_pageable_mbps = 0;
+static pthread_once_t g_model_once = PTHREAD_ONCE_INIT;
+
+static void load_model_from_env(void) {
+    const char *lat = getenv("ACL_STANDIN_COPY_US");
+    const char *bw = getenv("ACL_STANDIN_COPY_MBPS");
+    const char *pg = getenv("ACL_STANDIN_PAGEABLE_MBPS");
+    if (lat) g_copy_latency_us = (uint32_t)strtoul(lat, NULL, 10);
+    if (bw) g_copy_mbps = (uint32_t)strtoul(bw, NULL, 10);
+    if (pg) g_pageable_mbps = (uint32_t)strtoul(pg, NULL, 10);
+}
+
+void aclStandinSetCopyModel(uint32_t latency_us, uint32_t bandwidth_mbps) {
+    pthread_once(&g_model_once, load_model_from_env);
+    g_copy_latency_us = latency_us;
+    g_copy_mbps = bandwidth_mbps;
+}
+
+/* =========================
+ * 锁页区间表：aclrtMallocHost 分配的与 aclrtHostRegister 注册的主机内存
+ * ========================= */
+#define MAX_PINNED 64
+
+static struct { const uint8_t *base; size_t len; bool owned; } g_pinned[MAX_PINNED];
+static pthread_mutex_t g_pinned_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int pinned_add(const void *p, size_t len, bool owned) {
+    int rc = -1;
+    pthread_mutex_lock(&g_pinned_lock);
+    for (int i = 0; i < MAX_PINNED; ++i) {
+        if (!g_pinned[i].base) {
+            g_pinned[i].base = p;
+            g_pinned[i].len = len;
+            g_pinned[i].owned = owned;
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_pinned_lock);
+    return rc;
+}
+
+/* 按起始地址删除，owned 须与登记时一致 */
+static int pinned_del(const void *p, bool owned) {
+    int rc = -1;
+    pthread_mutex_lock(&g_pinned_lock);
+    for (int i = 0; i < MAX_PINNED; ++i) {
+        if (g_pinned[i].base == p && g_pinned[i].owned == owned) {
+            g_pinned[i].base = NULL;
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_pinned_lock);
+    return rc;
+}
+
+static bool is_pinned(const void *p, size_t len) {
+    const uint8_t *b = p;
+    bool hit = false;
+    pthread_mutex_lock(&g_pinned_lock);
+    for (int i = 0; i < MAX_PINNED && !hit; ++i) {
+        hit = g_pinned[i].base && b >= g_pinned[i].base &&
+              b + len <= g_pinned[i].base + g_pinned[i].len;
+    }
+    pthread_mutex_unlock(&g_pinned_lock);
+    return hit;
+}
+
+static void sleep_ns(uint64_t ns) {
+    if (!ns) return;
+    struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+}
+
+static void simulate_copy(void *dst, const void *src, size_t count, aclrtMemcpyKind kind) {
+    pthread_once(&g_model_once, load_model_from_env);
+    uint64_t ns = (uint64_t)g_copy_latency_us * 1000ULL;
+    if (g_copy_mbps) ns += (uint64_t)count * 1000ULL / g_copy_mbps;
+    sleep_ns(ns);
+    if (!count) return;
+
+    /* 主机侧未锁页：像真实运行时一样先拷进内部暂存区，再从暂存区 DMA */
+    const void *host = kind == ACL_MEMCPY_HOST_TO_DEVICE ? src
+                     : kind == ACL_MEMCPY_DEVICE_TO_HOST ? dst : NULL;
+    if (host && !is_pinned(host, count)) {
+        void *bounce = malloc(count);
+        if (bounce) {
+            if (g_pageable_mbps) sleep_ns((uint64_t)count * 1000ULL / g_pageable_mbps);
+            memcpy(bounce, src, count);
+            memcpy(dst, bounce, count);
+            free(bounce);
+            return;
+        }
+    }
+    memmove(dst, src, count);
+}
+
+/* =========================
+ * stream：一个后台线程按 FIFO 执行拷贝
+ * ========================= */
+typedef struct copy_op {
+    void *dst;
+    const void *src;
+    size_t count;
+    aclrtMemcpyKind kind;
+    struct copy_op *next;
+} copy_op_t;
+
+typedef struct standin_stream {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    copy_op_t *head;
+    copy_op_t *tail;
+    uint64_t enqueued;   /* 已入队操作数 */
+    uint64_t done;       /* 已完成操作数 */
+    bool stop;
+} standin_stream_t;
+
+typedef struct standin_event {
+    standin_stream_t *stream;
+    uint64_t seq;        /* 记录时 stream 的 enqueued */
+    bool recorded;
+} standin_event_t;
+
+static void *stream_main(void *arg) {
+    standin_stream_t *s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->head && !s->stop) pthread_cond_wait(&s->cond, &s->lock);
+        if (!s->head && s->stop) break;
+        copy_op_t *op = s->head;
+        pthread_mutex_unlock(&s->lock);
+
+        simulate_copy(op->dst, op->src, op->count, op->kind);
+
+        pthread_mutex_lock(&s->lock);
+        s->head = op->next;
+        if (!s->head) s->tail = NULL;
+        s->done++;
+        free(op);
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+aclError aclInit(const char *configPath) { return ACL_SUCCESS; }
+aclError aclFinalize(void) { return ACL_SUCCESS; }
+aclError aclrtSetDevice(int32_t deviceId) { return ACL_SUCCESS; }
+aclError aclrtResetDevice(int32_t deviceId) { return ACL_SUCCESS; }
+
+aclError aclrtMalloc(void **devPtr, size_t size, aclrtMemMallocPolicy policy) {
+    if (!devPtr || size == 0) return ACL_ERROR_INVALID_PARAM;
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, size) != 0) return ACL_ERROR_BAD_ALLOC;
+    *devPtr = p;
+    return ACL_SUCCESS;
+}
+
+aclError aclrtFree(void *devPtr) {
+    free(devPtr);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtMallocHost(void **hostPtr, size_t size) {
+    if (!hostPtr || size == 0) return ACL_ERROR_INVALID_PARAM;
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, size) != 0) return ACL_ERROR_BAD_ALLOC;
+    if (pinned_add(p, size, true) != 0) {
+        free(p);
+        return ACL_ERROR_BAD_ALLOC;
+    }
+    *hostPtr = p;
+    return ACL_SUCCESS;
+}
+
+aclError aclrtFreeHost(void *hostPtr) {
+    if (!hostPtr || pinned_del(hostPtr, true) != 0) return ACL_ERROR_INVALID_PARAM;
+    free(hostPtr);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtHostRegister(void *ptr, uint64_t size, aclrtHostRegisterType type, void **devPtr) {
+    if (!ptr || size == 0 || !devPtr) return ACL_ERROR_INVALID_PARAM;
+    if (is_pinned(ptr, 1) || pinned_add(ptr, size, false) != 0) return ACL_ERROR_INVALID_PARAM;
+    *devPtr = ptr;   /* 设备内存即主机内存，映射地址与主机地址相同 */
+    return ACL_SUCCESS;
+}
+
+aclError aclrtHostUnregister(void *ptr) {
+    if (!ptr || pinned_del(ptr, false) != 0) return ACL_ERROR_INVALID_PARAM;
+    return ACL_SUCCESS;
+}
+
+/* 设备上的清零不经 PCIe，只计单次拷贝延迟 */
+aclError aclrtMemset(void *devPtr, size_t maxCount, int32_t value, size_t count) {
+    if (!devPtr || count > maxCount) return ACL_ERROR_INVALID_PARAM;
+    pthread_once(&g_model_once, load_model_from_env);
+    sleep_ns((uint64_t)g_copy_latency_us * 1000ULL);
+    memset(devPtr, value, count);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtMemcpy(void *dst, size_t destMax, const void *src, size_t count,
+                     aclrtMemcpyKind kind) {
+    if (!dst || !src || count > destMax) return ACL_ERROR_INVALID_PARAM;
+    simulate_copy(dst, src, count, kind);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtMemcpyAsync(void *dst, size_t destMax, const void *src, size_t count,
+                          aclrtMemcpyKind kind, aclrtStream stream) {
+    standin_stream_t *s = stream;
+    if (!s || !dst || !src || count > destMax) return ACL_ERROR_INVALID_PARAM;
+    copy_op_t *op = calloc(1, sizeof(*op));
+    if (!op) return ACL_ERROR_BAD_ALLOC;
+    op->dst = dst;
+    op->src = src;
+    op->count = count;
+    op->kind = kind;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->tail) s->tail->next = op; else s->head = op;
+    s->tail = op;
+    s->enqueued++;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtCreateStream(aclrtStream *stream) {
+    if (!stream) return ACL_ERROR_INVALID_PARAM;
+    standin_stream_t *s = calloc(1, sizeof(*s));
+    if (!s) return ACL_ERROR_BAD_ALLOC;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->thread, NULL, stream_main, s) != 0) {
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->cond);
+        free(s);
+        return ACL_ERROR_BAD_ALLOC;
+    }
+    *stream = s;
+    return ACL_SUCCESS;
+}
+
+aclError aclrtDestroyStream(aclrtStream stream) {
+    standin_stream_t *s = stream;
+    if (!s) return ACL_ERROR_INVALID_PARAM;
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtSynchronizeStream(aclrtStream stream) {
+    standin_stream_t *s = stream;
+    if (!s) return ACL_ERROR_INVALID_PARAM;
+    pthread_mutex_lock(&s->lock);
+    while (s->done < s->enqueued) pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtCreateEvent(aclrtEvent *event) {
+    if (!event) return ACL_ERROR_INVALID_PARAM;
+    standin_event_t *e = calloc(1, sizeof(*e));
+    if (!e) return ACL_ERROR_BAD_ALLOC;
+    *event = e;
+    return ACL_SUCCESS;
+}
+
+aclError aclrtDestroyEvent(aclrtEvent event) {
+    free(event);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtRecordEvent(aclrtEvent event, aclrtStream stream) {
+    standin_event_t *e = event;
+    standin_stream_t *s = stream;
+    if (!e || !s) return ACL_ERROR_INVALID_PARAM;
+    pthread_mutex_lock(&s->lock);
+    e->stream = s;
+    e->seq = s->enqueued;
+    e->recorded = true;
+    pthread_mutex_unlock(&s->lock);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtQueryEventStatus(aclrtEvent event, aclrtEventRecordedStatus *status) {
+    standin_event_t *e = event;
+    if (!e || !status) return ACL_ERROR_INVALID_PARAM;
+    if (!e->recorded) {
+        *status = ACL_EVENT_RECORDED_STATUS_COMPLETE;
+        return ACL_SUCCESS;
+    }
+    standin_stream_t *s = e->stream;
+    pthread_mutex_lock(&s->lock);
+    *status = (s->done >= e->seq) ? ACL_EVENT_RECORDED_STATUS_COMPLETE
+                                  : ACL_EVENT_RECORDED_STATUS_NOT_READY;
+    pthread_mutex_unlock(&s->lock);
+    return ACL_SUCCESS;
+}
+
+aclError aclrtSynchronizeEvent(aclrtEvent event) {
+    standin_event_t *e = event;
+    if (!e) return ACL_ERROR_INVALID_PARAM;
+    if (!e->recorded) return ACL_SUCCESS;
+    standin_stream_t *s = e->stream;
+    pthread_mutex_lock(&s->lock);
+    while (s->done < e->seq) pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return ACL_SUCCESS;
+}
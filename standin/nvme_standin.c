@@ -0,0 +1,339 @@
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+
+/* 环境变量：
+ *   NVME_STANDIN_SIZE_MB  命名空间大小（默认 1024）
+ *   NVME_STANDIN_LAT_US   单命令服务延迟（默认 20）
+ *   NVME_STANDIN_MBPS     设备总带宽，所有 qpair 共享（默认 0 = 不限速）
+ *   NVME_STANDIN_MDTS     上报的 MDTS（默认 10，即 4MB）
+ *   NVME_STANDIN_NUMA     控制器所在的 NUMA 节点（默认 -1 = 未知）
+ *   NVME_STANDIN_ZERO_CMDS 支持的清零命令：bit0 Write Zeroes，bit1 Deallocate（释放后读出 0），默认 3
+ *
+ * spdk_env_init 的 shm_id >= 0 时（多进程），盘的内容放在
+ * /dev/shm/npu_nvme_standin.<shm_id>.<traddr>，shm_id 相同的进程看到同一块盘；
+ * 文件在进程退出后保留，由使用方删除。带宽模型仍按进程各自计算。 */
+
+#define STANDIN_BLOCK   4096u
+#define MAX_CTRLRS      16
+
+static uint64_t env_u64(const char *name, uint64_t def) {
+    const char *v = getenv(name);
+    return v ? strtoull(v, NULL, 10) : def;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct spdk_nvme_ns {
+    struct spdk_nvme_ctrlr *ctrlr;
+    uint64_t num_blocks;
+};
+
+struct spdk_pci_device {
+    int socket_id;
+};
+
+struct spdk_nvme_ctrlr {
+    char traddr[257];
+    struct spdk_pci_device pci;
+    int refs;
+    struct spdk_nvme_ctrlr_data cdata;
+    struct spdk_nvme_ns ns;
+    uint8_t *media;
+    size_t media_bytes;
+    uint64_t lat_ns;
+    uint64_t mbps;
+    uint32_t zero_cmds;      /* NVME_STANDIN_ZERO_CMDS */
+    pthread_mutex_t lock;
+    uint64_t busy_until;
+};
+
+typedef struct standin_cmd {
+    bool write;
+    void *payload;
+    uint64_t off;
+    size_t len;
+    uint64_t deadline;
+    spdk_nvme_cmd_cb cb;
+    void *cb_arg;
+    struct standin_cmd *next;
+} standin_cmd_t;
+
+struct spdk_nvme_qpair {
+    struct spdk_nvme_ctrlr *ctrlr;
+    standin_cmd_t *head, *tail;
+};
+
+static struct spdk_nvme_ctrlr *g_ctrlrs[MAX_CTRLRS];
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_shm_id = -1;
+
+void spdk_env_opts_init(struct spdk_env_opts *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->shm_id = -1;
+}
+int spdk_env_init(const struct spdk_env_opts *opts) {
+    g_shm_id = opts->shm_id;
+    return 0;
+}
+
+void *spdk_dma_zmalloc(size_t size, size_t align, uint64_t *phys_addr) {
+    void *p = NULL;
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (posix_memalign(&p, align, size ? size : align) != 0) return NULL;
+    memset(p, 0, size);
+    return p;
+}
+/* stand-in 不区分节点，socket_id 只做参数检查 */
+void *spdk_dma_zmalloc_socket(size_t size, size_t align, uint64_t *phys_addr, int socket_id) {
+    if (socket_id < SPDK_ENV_SOCKET_ID_ANY) return NULL;
+    return spdk_dma_zmalloc(size, align, phys_addr);
+}
+void spdk_dma_free(void *buf) { free(buf); }
+
+int spdk_pci_device_get_socket_id(struct spdk_pci_device *dev) {
+    return dev ? dev->socket_id : SPDK_ENV_SOCKET_ID_ANY;
+}
+
+/* 与 SPDK 一样要求起止按 2MB 对齐；stand-in 不做地址翻译，只检查参数 */
+#define STANDIN_MEM_ALIGN (2u * 1024 * 1024)
+int spdk_mem_register(void *vaddr, size_t len) {
+    if (!vaddr || len == 0 || ((uintptr_t)vaddr | len) & (STANDIN_MEM_ALIGN - 1)) return -EINVAL;
+    return 0;
+}
+int spdk_mem_unregister(void *vaddr, size_t len) {
+    if (!vaddr || len == 0 || ((uintptr_t)vaddr | len) & (STANDIN_MEM_ALIGN - 1)) return -EINVAL;
+    return 0;
+}
+
+void spdk_nvme_trid_populate_transport(struct spdk_nvme_transport_id *trid,
+                                       enum spdk_nvme_transport_type trtype) {
+    trid->trtype = trtype;
+}
+
+static struct spdk_nvme_ctrlr *ctrlr_create(const char *traddr) {
+    struct spdk_nvme_ctrlr *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    snprintf(c->traddr, sizeof(c->traddr), "%s", traddr);
+    c->media_bytes = env_u64("NVME_STANDIN_SIZE_MB", 1024) << 20;
+    if (g_shm_id >= 0) {
+        char path[320];
+        snprintf(path, sizeof(path), "/dev/shm/npu_nvme_standin.%d.%s", g_shm_id, traddr);
+        int fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0 || ftruncate(fd, (off_t)c->media_bytes) != 0) {
+            if (fd >= 0) close(fd);
+            free(c);
+            return NULL;
+        }
+        c->media = mmap(NULL, c->media_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        c->media = mmap(NULL, c->media_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    if (c->media == MAP_FAILED) { free(c); return NULL; }
+    c->lat_ns = env_u64("NVME_STANDIN_LAT_US", 20) * 1000ULL;
+    c->mbps = env_u64("NVME_STANDIN_MBPS", 0);
+    c->cdata.mdts = (uint8_t)env_u64("NVME_STANDIN_MDTS", 10);
+    c->zero_cmds = (uint32_t)env_u64("NVME_STANDIN_ZERO_CMDS", 3);
+    const char *numa = getenv("NVME_STANDIN_NUMA");
+    c->pci.socket_id = numa ? atoi(numa) : SPDK_ENV_SOCKET_ID_ANY;
+    memcpy(c->cdata.sn, "STANDIN0000000000000", 20);
+    memset(c->cdata.mn, ' ', sizeof(c->cdata.mn));
+    memcpy(c->cdata.mn, "npu_nvme ram stand-in", 21);
+    c->ns.ctrlr = c;
+    c->ns.num_blocks = c->media_bytes / STANDIN_BLOCK;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+int spdk_nvme_probe(const struct spdk_nvme_transport_id *trid, void *cb_ctx,
+                    spdk_nvme_probe_cb probe_cb, spdk_nvme_attach_cb attach_cb,
+                    spdk_nvme_remove_cb remove_cb) {
+    struct spdk_nvme_ctrlr_opts opts = { 0 };
+    if (probe_cb && !probe_cb(cb_ctx, trid, &opts)) return 0;
+    pthread_mutex_lock(&g_lock);
+    struct spdk_nvme_ctrlr *c = NULL;
+    int free_slot = -1;
+    for (int i = 0; i < MAX_CTRLRS; ++i) {
+        if (g_ctrlrs[i] && strcmp(g_ctrlrs[i]->traddr, trid->traddr) == 0) c = g_ctrlrs[i];
+        else if (!g_ctrlrs[i] && free_slot < 0) free_slot = i;
+    }
+    if (!c) {
+        if (free_slot < 0 || !(c = ctrlr_create(trid->traddr))) {
+            pthread_mutex_unlock(&g_lock);
+            return -1;
+        }
+        g_ctrlrs[free_slot] = c;
+    }
+    c->refs++;
+    pthread_mutex_unlock(&g_lock);
+    if (attach_cb) attach_cb(cb_ctx, trid, c, &opts);
+    return 0;
+}
+
+int spdk_nvme_detach(struct spdk_nvme_ctrlr *ctrlr) {
+    pthread_mutex_lock(&g_lock);
+    if (--ctrlr->refs == 0) {
+        for (int i = 0; i < MAX_CTRLRS; ++i)
+            if (g_ctrlrs[i] == ctrlr) g_ctrlrs[i] = NULL;
+        munmap(ctrlr->media, ctrlr->media_bytes);
+        pthread_mutex_destroy(&ctrlr->lock);
+        free(ctrlr);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+const struct spdk_nvme_ctrlr_data *spdk_nvme_ctrlr_get_data(struct spdk_nvme_ctrlr *c) { return &c->cdata; }
+struct spdk_pci_device *spdk_nvme_ctrlr_get_pci_device(struct spdk_nvme_ctrlr *c) { return &c->pci; }
+uint32_t spdk_nvme_ctrlr_get_first_active_ns(struct spdk_nvme_ctrlr *c) { return 1; }
+uint32_t spdk_nvme_ctrlr_get_next_active_ns(struct spdk_nvme_ctrlr *c, uint32_t prev) { return 0; }
+struct spdk_nvme_ns *spdk_nvme_ctrlr_get_ns(struct spdk_nvme_ctrlr *c, uint32_t nsid) {
+    return nsid == 1 ? &c->ns : NULL;
+}
+bool spdk_nvme_ns_is_active(struct spdk_nvme_ns *ns) { return ns != NULL; }
+uint32_t spdk_nvme_ns_get_sector_size(struct spdk_nvme_ns *ns) { return STANDIN_BLOCK; }
+uint64_t spdk_nvme_ns_get_num_sectors(struct spdk_nvme_ns *ns) { return ns->num_blocks; }
+uint32_t spdk_nvme_ns_get_flags(struct spdk_nvme_ns *ns) {
+    uint32_t f = SPDK_NVME_NS_FLUSH_SUPPORTED;
+    if (ns->ctrlr->zero_cmds & 1) f |= SPDK_NVME_NS_WRITE_ZEROES_SUPPORTED;
+    if (ns->ctrlr->zero_cmds & 2) f |= SPDK_NVME_NS_DEALLOCATE_SUPPORTED;
+    return f;
+}
+enum spdk_nvme_dealloc_logical_block_read_value
+spdk_nvme_ns_get_dealloc_logical_block_read_value(struct spdk_nvme_ns *ns) {
+    return (ns->ctrlr->zero_cmds & 2) ? SPDK_NVME_DEALLOC_READ_00 : SPDK_NVME_DEALLOC_NOT_REPORTED;
+}
+
+/* 队列深度不受限，只为接口对齐 */
+void spdk_nvme_ctrlr_get_default_io_qpair_opts(struct spdk_nvme_ctrlr *c,
+                                               struct spdk_nvme_io_qpair_opts *opts,
+                                               size_t opts_size) {
+    opts->io_queue_size = 256;
+    opts->io_queue_requests = 512;
+}
+
+struct spdk_nvme_qpair *spdk_nvme_ctrlr_alloc_io_qpair(struct spdk_nvme_ctrlr *c,
+                                                       const struct spdk_nvme_io_qpair_opts *opts,
+                                                       size_t opts_size) {
+    struct spdk_nvme_qpair *q = calloc(1, sizeof(*q));
+    if (q) q->ctrlr = c;
+    return q;
+}
+
+int spdk_nvme_ctrlr_free_io_qpair(struct spdk_nvme_qpair *q) {
+    while (q->head) {
+        standin_cmd_t *c = q->head;
+        q->head = c->next;
+        free(c);
+    }
+    free(q);
+    return 0;
+}
+
+static int submit(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *q, bool write,
+                  void *payload, uint64_t lba, uint32_t lba_count,
+                  spdk_nvme_cmd_cb cb_fn, void *cb_arg) {
+    struct spdk_nvme_ctrlr *c = ns->ctrlr;
+    if (lba_count == 0 || lba + lba_count > ns->num_blocks) return -EINVAL;
+    standin_cmd_t *cmd = calloc(1, sizeof(*cmd));
+    if (!cmd) return -ENOMEM;
+    cmd->write = write;
+    cmd->payload = payload;
+    cmd->off = lba * STANDIN_BLOCK;
+    cmd->len = (size_t)lba_count * STANDIN_BLOCK;
+    cmd->cb = cb_fn;
+    cmd->cb_arg = cb_arg;
+
+    /* 设备带宽在所有 qpair 之间共享，单命令延迟叠加在其上；清零命令（无 payload）不传数据 */
+    uint64_t now = now_ns();
+    pthread_mutex_lock(&c->lock);
+    uint64_t start = c->busy_until > now ? c->busy_until : now;
+    uint64_t xfer = (c->mbps && payload) ? (uint64_t)cmd->len * 1000ULL / c->mbps : 0;
+    c->busy_until = start + xfer;
+    pthread_mutex_unlock(&c->lock);
+    cmd->deadline = start + xfer + c->lat_ns;
+
+    if (q->tail) q->tail->next = cmd; else q->head = cmd;
+    q->tail = cmd;
+    return 0;
+}
+
+int spdk_nvme_ns_cmd_write(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                           void *payload, uint64_t lba, uint32_t lba_count,
+                           spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags) {
+    return submit(ns, qpair, true, payload, lba, lba_count, cb_fn, cb_arg);
+}
+
+int spdk_nvme_ns_cmd_read(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                          void *payload, uint64_t lba, uint32_t lba_count,
+                          spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags) {
+    return submit(ns, qpair, false, payload, lba, lba_count, cb_fn, cb_arg);
+}
+
+/* Write Zeroes 与 Deallocate 都是无 payload 的写，完成时把区间清零 */
+int spdk_nvme_ns_cmd_write_zeroes(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                                  uint64_t lba, uint32_t lba_count,
+                                  spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags) {
+    if (!(ns->ctrlr->zero_cmds & 1)) return -EINVAL;
+    return submit(ns, qpair, true, NULL, lba, lba_count, cb_fn, cb_arg);
+}
+
+/* 只支持单个区间，够 npu_nvme 用 */
+int spdk_nvme_ns_cmd_dataset_management(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                                        uint32_t type, const struct spdk_nvme_dsm_range *ranges,
+                                        uint16_t num_ranges, spdk_nvme_cmd_cb cb_fn, void *cb_arg) {
+    if (!(ns->ctrlr->zero_cmds & 2) || type != SPDK_NVME_DSM_ATTR_DEALLOCATE || num_ranges != 1)
+        return -EINVAL;
+    return submit(ns, qpair, true, NULL, ranges[0].starting_lba, ranges[0].length, cb_fn, cb_arg);
+}
+
+/* 命令完成即已“落盘”，flush 只需按同样的延迟模型完成 */
+int spdk_nvme_ns_cmd_flush(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *q,
+                           spdk_nvme_cmd_cb cb_fn, void *cb_arg) {
+    standin_cmd_t *cmd = calloc(1, sizeof(*cmd));
+    if (!cmd) return -ENOMEM;
+    cmd->cb = cb_fn;
+    cmd->cb_arg = cb_arg;
+    cmd->deadline = now_ns() + ns->ctrlr->lat_ns;
+    if (q->tail) q->tail->next = cmd; else q->head = cmd;
+    q->tail = cmd;
+    return 0;
+}
+
+int32_t spdk_nvme_qpair_process_completions(struct spdk_nvme_qpair *q, uint32_t max) {
+    uint64_t now = now_ns();
+    int32_t n = 0;
+    standin_cmd_t **pp = &q->head, *prev = NULL;
+    while (*pp && (max == 0 || (uint32_t)n < max)) {
+        standin_cmd_t *cmd = *pp;
+        if (cmd->deadline > now) { prev = cmd; pp = &cmd->next; continue; }
+        *pp = cmd->next;
+        if (q->tail == cmd) q->tail = prev;
+        /* 数据在完成时才落盘/读出，提前复用 buffer 的错误能在测试里暴露 */
+        uint8_t *media = q->ctrlr->media + cmd->off;
+        if (cmd->len == 0) {
+            /* flush */
+        } else if (cmd->write && !cmd->payload) {
+            memset(media, 0, cmd->len);
+        } else if (cmd->write) {
+            memcpy(media, cmd->payload, cmd->len);
+        } else {
+            memcpy(cmd->payload, media, cmd->len);
+        }
+        struct spdk_nvme_cpl cpl;
+        memset(&cpl, 0, sizeof(cpl));
+        if (cmd->cb) cmd->cb(cmd->cb_arg, &cpl);
+        free(cmd);
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,28 @@
+#ifndef SPDK_STANDIN_ENV_H
+#define SPDK_STANDIN_ENV_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#define SPDK_ENV_SOCKET_ID_ANY (-1)
+
+struct spdk_pci_device;
+
+struct spdk_env_opts {
+    const char *name;
+    const char *core_mask;
+    int shm_id;
+};
+void spdk_env_opts_init(struct spdk_env_opts *opts);
+int spdk_env_init(const struct spdk_env_opts *opts);
+void *spdk_dma_zmalloc(size_t size, size_t align, uint64_t *phys_addr);
+void *spdk_dma_zmalloc_socket(size_t size, size_t align, uint64_t *phys_addr, int socket_id);
+void spdk_dma_free(void *buf);
+int spdk_pci_device_get_socket_id(struct spdk_pci_device *dev);
+int spdk_mem_register(void *vaddr, size_t len);
+int spdk_mem_unregister(void *vaddr, size_t len);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,140 @@
+/* =========================
+ * NVMe stand-in（RAM 模拟的 SPDK 子集）
+ * 只覆盖 npu_nvme 用到的 spdk_nvme_* 接口，命名空间是一段内存，
+ * 命令在 process_completions 中按 延迟 + 共享带宽 的模型完成。
+ * ========================= */
+#ifndef SPDK_STANDIN_NVME_H
+#define SPDK_STANDIN_NVME_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct spdk_nvme_ctrlr;
+struct spdk_nvme_ns;
+struct spdk_nvme_qpair;
+
+enum spdk_nvme_transport_type {
+    SPDK_NVME_TRANSPORT_PCIE = 256,
+};
+
+struct spdk_nvme_transport_id {
+    enum spdk_nvme_transport_type trtype;
+    char traddr[257];
+};
+
+struct spdk_nvme_ctrlr_opts {
+    uint32_t num_io_queues;
+};
+
+struct spdk_nvme_io_qpair_opts {
+    uint32_t io_queue_size;
+    uint32_t io_queue_requests;
+};
+
+struct spdk_nvme_ctrlr_data {
+    uint8_t sn[20];
+    uint8_t mn[40];
+    uint8_t mdts;
+};
+
+struct spdk_nvme_status {
+    uint16_t p   : 1;
+    uint16_t sc  : 8;
+    uint16_t sct : 3;
+    uint16_t crd : 2;
+    uint16_t m   : 1;
+    uint16_t dnr : 1;
+};
+
+struct spdk_nvme_cpl {
+    uint32_t cdw0;
+    uint32_t cdw1;
+    uint16_t sqhd;
+    uint16_t sqid;
+    uint16_t cid;
+    struct spdk_nvme_status status;
+};
+
+enum spdk_nvme_ns_flags {
+    SPDK_NVME_NS_DEALLOCATE_SUPPORTED  = 1 << 0,
+    SPDK_NVME_NS_FLUSH_SUPPORTED       = 1 << 1,
+    SPDK_NVME_NS_WRITE_ZEROES_SUPPORTED = 1 << 3,
+};
+
+enum spdk_nvme_dealloc_logical_block_read_value {
+    SPDK_NVME_DEALLOC_NOT_REPORTED = 0,
+    SPDK_NVME_DEALLOC_READ_00      = 1,
+    SPDK_NVME_DEALLOC_READ_FF      = 2,
+};
+
+#define SPDK_NVME_DSM_ATTR_DEALLOCATE 0x4
+
+struct spdk_nvme_dsm_range {
+    uint32_t attributes;
+    uint32_t length;
+    uint64_t starting_lba;
+};
+
+static inline bool spdk_nvme_cpl_is_error(const struct spdk_nvme_cpl *cpl) {
+    return cpl->status.sc != 0 || cpl->status.sct != 0;
+}
+
+typedef void (*spdk_nvme_cmd_cb)(void *ctx, const struct spdk_nvme_cpl *cpl);
+typedef bool (*spdk_nvme_probe_cb)(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+                                   struct spdk_nvme_ctrlr_opts *opts);
+typedef void (*spdk_nvme_attach_cb)(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+                                    struct spdk_nvme_ctrlr *ctrlr,
+                                    const struct spdk_nvme_ctrlr_opts *opts);
+typedef void (*spdk_nvme_remove_cb)(void *cb_ctx, struct spdk_nvme_ctrlr *ctrlr);
+
+void spdk_nvme_trid_populate_transport(struct spdk_nvme_transport_id *trid,
+                                       enum spdk_nvme_transport_type trtype);
+int spdk_nvme_probe(const struct spdk_nvme_transport_id *trid, void *cb_ctx,
+                    spdk_nvme_probe_cb probe_cb, spdk_nvme_attach_cb attach_cb,
+                    spdk_nvme_remove_cb remove_cb);
+int spdk_nvme_detach(struct spdk_nvme_ctrlr *ctrlr);
+
+const struct spdk_nvme_ctrlr_data *spdk_nvme_ctrlr_get_data(struct spdk_nvme_ctrlr *ctrlr);
+struct spdk_pci_device *spdk_nvme_ctrlr_get_pci_device(struct spdk_nvme_ctrlr *ctrlr);
+uint32_t spdk_nvme_ctrlr_get_first_active_ns(struct spdk_nvme_ctrlr *ctrlr);
+uint32_t spdk_nvme_ctrlr_get_next_active_ns(struct spdk_nvme_ctrlr *ctrlr, uint32_t prev_nsid);
+struct spdk_nvme_ns *spdk_nvme_ctrlr_get_ns(struct spdk_nvme_ctrlr *ctrlr, uint32_t nsid);
+bool spdk_nvme_ns_is_active(struct spdk_nvme_ns *ns);
+uint32_t spdk_nvme_ns_get_sector_size(struct spdk_nvme_ns *ns);
+uint64_t spdk_nvme_ns_get_num_sectors(struct spdk_nvme_ns *ns);
+uint32_t spdk_nvme_ns_get_flags(struct spdk_nvme_ns *ns);
+enum spdk_nvme_dealloc_logical_block_read_value
+spdk_nvme_ns_get_dealloc_logical_block_read_value(struct spdk_nvme_ns *ns);
+
+void spdk_nvme_ctrlr_get_default_io_qpair_opts(struct spdk_nvme_ctrlr *ctrlr,
+                                               struct spdk_nvme_io_qpair_opts *opts,
+                                               size_t opts_size);
+struct spdk_nvme_qpair *spdk_nvme_ctrlr_alloc_io_qpair(struct spdk_nvme_ctrlr *ctrlr,
+                                                       const struct spdk_nvme_io_qpair_opts *opts,
+                                                       size_t opts_size);
+int spdk_nvme_ctrlr_free_io_qpair(struct spdk_nvme_qpair *qpair);
+int32_t spdk_nvme_qpair_process_completions(struct spdk_nvme_qpair *qpair,
+                                            uint32_t max_completions);
+
+int spdk_nvme_ns_cmd_write(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                           void *payload, uint64_t lba, uint32_t lba_count,
+                           spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags);
+int spdk_nvme_ns_cmd_read(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                          void *payload, uint64_t lba, uint32_t lba_count,
+                          spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags);
+int spdk_nvme_ns_cmd_write_zeroes(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                                  uint64_t lba, uint32_t lba_count,
+                                  spdk_nvme_cmd_cb cb_fn, void *cb_arg, uint32_t io_flags);
+int spdk_nvme_ns_cmd_dataset_management(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                                        uint32_t type, const struct spdk_nvme_dsm_range *ranges,
+                                        uint16_t num_ranges, spdk_nvme_cmd_cb cb_fn, void *cb_arg);
+int spdk_nvme_ns_cmd_flush(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair,
+                           spdk_nvme_cmd_cb cb_fn, void *cb_arg);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,13 @@
+#ifndef SPDK_STANDIN_STDINC_H
+#define SPDK_STANDIN_STDINC_H
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#endif
@@ -0,0 +1,3 @@
+#ifndef SPDK_STANDIN_VMD_H
+#define SPDK_STANDIN_VMD_H
+#endif
@@ -23,7 +23,34 @@ BATCH_SIZE = 4
 SEQ_LEN = 128
 NVME_DEVICE = "0000:83:00.0"
 PIPELINE_DEPTH = 8
+NUM_WORKERS = 1
+# 异步保存：NVMe 写与下一步的前向/反向重叠，在下一次 optimizer.step 前等待完成
+ASYNC_CHECKPOINT = False
+# 增量保存：只写与上次相比有变化的块（冻结层、LoRA 基座权重等不重复写）
+INCREMENTAL_CHECKPOINT = False
+# 压缩保存：None 或 "lz4"（按 dtype 做 byte-shuffle，bf16/fp16 权重通常能省 10~20%）
+COMPRESS_CHECKPOINT = None
+# 读回时按每个 chunk 的 CRC32C 校验（load 出错直接抛异常）；
+# FULL_VERIFY 额外做一次 torch.save 快照 + allclose 全量比对，只在排查问题时打开
+CHECKSUM_CHECKPOINT = True
+FULL_VERIFY = False
+# 盘上格式：元数据与代号写在 NVMe 上，两个 slot 轮换提交，恢复不需要 checkpoint_meta.pt
+DEVICE_FORMAT = False
 CHUNK_SIZE = 512 * 1024 
+# 自动调优：>0 时 init 后在 AUTOTUNE_SCRATCH_OFFSET 处（内容会被覆盖）扫描 depth 与命令长度，
+# 结果按 SSD 序列号/型号缓存在 ~/.npu_nvme_tune，之后的运行不调也直接套用
+AUTOTUNE_MS = 0
+AUTOTUNE_SCRATCH_OFFSET = 512 * 1024**3
+# 多 rank 分片：torchrun 启动时各 rank 经 SPDK 多进程共用 NVME_DEVICE，各写互不重叠的区域，
+# rank 0 把各 rank 的元数据合并进 checkpoint_meta.pt。区域从 SHARD_TABLE_OFFSET 的分片表之后开始
+RANK = int(os.environ.get("RANK", 0))
+WORLD_SIZE = int(os.environ.get("WORLD_SIZE", 1))
+SHARD_TABLE_OFFSET = 0
+# 流式读回：按 named_parameters 顺序（embedding 在前）读，记录第一个参数可用的时间；不做 CRC 比对
+STREAM_LOAD = False
+# 快照后排空（需 ASYNC_CHECKPOINT）：>0 时在 NPU 上预留这么多字节的暂存区，保存只占用 D2D 拷贝
+# （放不下的参数当场直接写盘）的时间，optimizer.step 不必等写盘；此时不做读回验证（会覆盖已更新的参数）
+SNAPSHOT_BUDGET = 0
 ENABLE_PROFILING = True
 
 '''
@@ -76,7 +103,16 @@ def train_with_checkpoints():
     
     print("[INFO] Using NPU-to-NVMe zero-copy checkpointing...")
     checkpoint = DirectCheckpoint(NVME_DEVICE, npu_device_id=int(DEVICE.split(":")[1]), 
-                                    pipeline_depth=PIPELINE_DEPTH, requested_chunk_size=CHUNK_SIZE, enable_profiling=ENABLE_PROFILING)
+                                    pipeline_depth=PIPELINE_DEPTH, requested_chunk_size=CHUNK_SIZE, enable_profiling=ENABLE_PROFILING,
+                                    num_workers=NUM_WORKERS, incremental=INCREMENTAL_CHECKPOINT,
+                                    compression=COMPRESS_CHECKPOINT,
+                                    checksum=CHECKSUM_CHECKPOINT,
+                                    device_format=DEVICE_FORMAT,
+                                    rank=RANK, world_size=WORLD_SIZE,
+                                    shard_table=SHARD_TABLE_OFFSET,
+                                    snapshot_budget=SNAPSHOT_BUDGET)
+    if AUTOTUNE_MS > 0:
+        print(f"[INFO] autotune: {checkpoint.autotune(AUTOTUNE_SCRATCH_OFFSET, budget_ms=AUTOTUNE_MS)}")
        
     step = 0
     checkpoint_size = []
@@ -84,6 +120,7 @@ def train_with_checkpoints():
     checkpoint_save_bw = []
     checkpoint_load_time = []
     checkpoint_load_bw = []
+    checkpoint_stall = []
 
     if ENABLE_PROFILING:
         if not os.path.exists("profiling"):
@@ -94,6 +131,85 @@ def train_with_checkpoints():
         if not os.path.exists("profiling/" + dir_name):
             os.makedirs("profiling/" + dir_name)
     
+    def finish_checkpoint(step, size, num_chunks, time_save, bw_save, stall=None):
+        print(f"[Checkpoint] Saved directly to NVMe (Step {step})")
+        checkpoint_size.append(size)
+        checkpoint_save_time.append(time_save)
+        checkpoint_save_bw.append(bw_save)
+        print(f"[Checkpoint] Save Time: {time_save:.2f}s")
+        if stall is not None:
+            # 快照：训练步只被占用 stall，time_save 为后台排空时间；参数已更新，不读回
+            checkpoint_stall.append(stall)
+            print(f"[Checkpoint] Step stall: {stall:.3f}s (drain {time_save:.2f}s)")
+            if ENABLE_PROFILING:
+                with open("profiling/" + dir_name + "/checkpoint_stats.txt", "a+") as f:
+                    f.write(f"=== Step {step} ===\n")
+                    f.write(f"Checkpoint size: {size / 1024 / 1024:.2f} MB\n")
+                    f.write(f"Step stall: {stall:.3f} s\n")
+                    f.write(f"Drain time: {time_save:.2f} s\n")
+                    f.write(f"Drain bandwidth: {bw_save:.2f} MB/s\n")
+            checkpoint.reset_stats()
+            return num_chunks
+
+        torch_path = "checkpoint_torch.pt"
+        if FULL_VERIFY:
+            torch.save(model.state_dict(), torch_path)
+
+        # 读回验证：开启 CRC32C 时 load 内部逐 chunk 比对，不一致直接抛异常
+        time_first = None
+        if STREAM_LOAD:
+            stream = checkpoint.load_stream(model, meta_path="checkpoint_meta.pt")
+            size, num_chunks, time_load, bw_load = stream.wait()
+            time_first = stream.time_to_first
+        else:
+            size, num_chunks, time_load, bw_load = checkpoint.load(model, meta_path="checkpoint_meta.pt")
+        checkpoint_load_time.append(time_load)
+        checkpoint_load_bw.append(bw_load)
+        print(f"[Checkpoint] Load Time: {time_load:.2f}s")
+        if CHECKSUM_CHECKPOINT and not STREAM_LOAD:
+            print(f"[Verify] crc32c ok for all {num_chunks} chunks (Step {step})")
+
+        if FULL_VERIFY:
+            torch_state = torch.load(torch_path, map_location="cpu")
+            mismatches = []
+            for name, param in model.state_dict().items():
+                ref = torch_state.get(name)
+                if ref is None:
+                    mismatches.append(name + "(missing)")
+                    continue
+                if not torch.allclose(param.detach().cpu(), ref.cpu(), rtol=1e-4, atol=1e-6):
+                    mismatches.append(name)
+            if mismatches:
+                print(f"[Verify] Mismatch count: {len(mismatches)}; first 5: {mismatches[:5]}")
+            else:
+                print(f"[Verify] Direct checkpoint matches torch.save snapshot (Step {step})")
+
+        with open("profiling/" + dir_name + "/checkpoint_stats.txt", "a+") as f:
+            f.write(f"=== Step {step} ===\n")
+            f.write(f"Checkpoint size: {size / 1024 / 1024:.2f} MB\n")
+            f.write(f"Save time: {time_save:.2f} s\n")
+            f.write(f"Save bandwidth: {bw_save:.2f} MB/s\n")
+            f.write(f"Load time: {time_load:.2f} s\n")
+            f.write(f"Load bandwidth: {bw_load:.2f} MB/s\n")
+            if time_first is not None:
+                f.write(f"Time to first param: {time_first * 1000:.2f} ms\n")
+            f.write(f"Chunks number: {num_chunks}\n")
+            f.write(f"Chunks size: {num_chunks * CHUNK_SIZE / 1024 / 1024:.2f} MB\n")
+            # 本步 save + load 的各阶段延迟分布（us）
+            for kind, d in checkpoint.stats().items():
+                cache = (f"cache hit {d['cache_hit_rate'] * 100:.1f}%" if kind == "read"
+                         else f"cache fill {d['cache_fill_rate'] * 100:.1f}%")
+                f.write(f"{kind}: {d['commands']} cmds, {d['errors']} errors, {cache}\n")
+                for stage in ("copy", "nvme", "queue", "e2e"):
+                    h = d[stage]
+                    f.write(f"  {stage:5s} p50 {h['p50_us']:.1f} p99 {h['p99_us']:.1f} "
+                            f"p999 {h['p999_us']:.1f} us\n")
+        checkpoint.reset_stats()
+
+        return num_chunks
+
+    pending = None
+
     for epoch in range(3):
         print(f"\n--- Epoch {epoch+1} ---")
         
@@ -108,6 +224,13 @@ def train_with_checkpoints():
             # 反向传播
             optimizer.zero_grad()
             loss.backward()
+
+            # 异步保存的数据在 optimizer.step 修改参数前必须落盘；快照保存已拷走参数，不必等
+            if pending is not None and pending[1].stall is None:
+                saved_step, fut = pending
+                size, num_chunks, time_save, bw_save = fut.wait()
+                num_chunks = finish_checkpoint(saved_step, size, num_chunks, time_save, bw_save)
+                pending = None
             optimizer.step()
             
             # 打印日志
@@ -116,60 +239,41 @@ def train_with_checkpoints():
             
             # 每50步保存一次检查点
             if step % CHECKPOINT_INTERVAL == 0:
-                size, num_chunks, time_save, bw_save = checkpoint.save(model)
-                print(f"[Checkpoint] Saved directly to NVMe (Step {step})")
-                checkpoint_size.append(size)
-                checkpoint_save_time.append(time_save)
-                checkpoint_save_bw.append(bw_save)
-                print(f"[Checkpoint] Save Time: {time_save:.2f}s")
-
-                torch_path = "checkpoint_torch.pt"
-                torch.save(model.state_dict(), torch_path)
-                
-                # 验证 DirectCheckpoint 保存的内容是否正确
-                size, num_chunks, time_load, bw_load = checkpoint.load(model, meta_path="checkpoint_meta.pt")
-                checkpoint_load_time.append(time_load)
-                checkpoint_load_bw.append(bw_load)
-                print(f"[Checkpoint] Load Time: {time_load:.2f}s")
-
-                torch_state = torch.load(torch_path, map_location="cpu")
-                mismatches = []
-                for name, param in model.state_dict().items():
-                    ref = torch_state.get(name)
-                    if ref is None:
-                        mismatches.append(name + "(missing)")
-                        continue
-                    if not torch.allclose(param.detach().cpu(), ref.cpu(), rtol=1e-4, atol=1e-6):
-                        mismatches.append(name)
-                if mismatches:
-                    print(f"[Verify] Mismatch count: {len(mismatches)}; first 5: {mismatches[:5]}")
+                if pending is not None:
+                    # 上一次快照的后台排空（save_async 也会先等它完成）
+                    saved_step, fut = pending
+                    size, num_chunks, time_save, bw_save = fut.wait()
+                    num_chunks = finish_checkpoint(saved_step, size, num_chunks, time_save, bw_save,
+                                                   fut.stall)
+                    pending = None
+                if ASYNC_CHECKPOINT:
+                    pending = (step, checkpoint.save_async(model))
                 else:
-                    print(f"[Verify] Direct checkpoint matches torch.save snapshot (Step {step})")
+                    size, num_chunks, time_save, bw_save = checkpoint.save(model)
+                    num_chunks = finish_checkpoint(step, size, num_chunks, time_save, bw_save)
 
-                with open("profiling/" + dir_name + "/checkpoint_stats.txt", "a+") as f:
-                    f.write(f"=== Step {step} ===\n")
-                    f.write(f"Checkpoint size: {size / 1024 / 1024:.2f} MB\n")
-                    f.write(f"Save time: {time_save:.2f} s\n")
-                    f.write(f"Save bandwidth: {bw_save:.2f} MB/s\n")
-                    f.write(f"Load time: {time_load:.2f} s\n")
-                    f.write(f"Load bandwidth: {bw_load:.2f} MB/s\n")
-                    f.write(f"Chunks number: {num_chunks}\n")
-                    f.write(f"Chunks size: {num_chunks * CHUNK_SIZE / 1024 / 1024:.2f} MB\n")
-            
             if step >= MAX_STEPS:
+                if pending is not None:
+                    saved_step, fut = pending
+                    size, num_chunks, time_save, bw_save = fut.wait()
+                    num_chunks = finish_checkpoint(saved_step, size, num_chunks, time_save, bw_save,
+                                                   fut.stall)
+                    pending = None
                 print("\n=== Checkpoint Statistics ===")
                 print(f"Total checkpoints: {len(checkpoint_save_time)}")
                 print(f"Average save time: {sum(checkpoint_save_time)/len(checkpoint_save_time):.2f}s")
-                print(f"Average load time: {sum(checkpoint_load_time)/len(checkpoint_load_time):.2f}s")
+                print(f"Average load time: {sum(checkpoint_load_time)/max(len(checkpoint_load_time), 1):.2f}s")
                 print(f"Average save bandwidth: {sum(checkpoint_save_bw)/len(checkpoint_save_bw):.2f} MB/s")
-                print(f"Average load bandwidth: {sum(checkpoint_load_bw)/len(checkpoint_load_bw):.2f} MB/s")
+                print(f"Average load bandwidth: {sum(checkpoint_load_bw)/max(len(checkpoint_load_bw), 1):.2f} MB/s")
                 print(f"Checkpoint size: {sum(checkpoint_size)/len(checkpoint_size) / 1024 / 1024:.2f} MB")
                 print(f"Chunks number: {num_chunks}")
                 print(f"Chunks size: {num_chunks * CHUNK_SIZE / 1024 / 1024:.2f} MB")
                 print(f"Min save time: {min(checkpoint_save_time):.2f}s")
                 print(f"Max save time: {max(checkpoint_save_time):.2f}s")
-                print(f"Min load time: {min(checkpoint_load_time):.2f}s")
-                print(f"Max load time: {max(checkpoint_load_time):.2f}s")
+                print(f"Min load time: {min(checkpoint_load_time, default=0):.2f}s")
+                print(f"Max load time: {max(checkpoint_load_time, default=0):.2f}s")
+                if checkpoint_stall:
+                    print(f"Average step stall: {sum(checkpoint_stall)/len(checkpoint_stall):.3f}s")
 
                 if ENABLE_PROFILING:
                     os.rename("time_write.csv", "profiling/" + dir_name + "/time_write.csv")
@@ -180,16 +284,18 @@ def train_with_checkpoints():
                         f.write("=== Checkpoint Statistics ===\n")
                         f.write(f"Total checkpoints: {len(checkpoint_save_time)}\n")
                         f.write(f"Average save time: {sum(checkpoint_save_time)/len(checkpoint_save_time):.2f}s\n")
-                        f.write(f"Average load time: {sum(checkpoint_load_time)/len(checkpoint_load_time):.2f}s\n")
+                        f.write(f"Average load time: {sum(checkpoint_load_time)/max(len(checkpoint_load_time), 1):.2f}s\n")
                         f.write(f"Average save bandwidth: {sum(checkpoint_save_bw)/len(checkpoint_save_bw):.2f} MB/s\n")
-                        f.write(f"Average load bandwidth: {sum(checkpoint_load_bw)/len(checkpoint_load_bw):.2f} MB/s\n")
+                        f.write(f"Average load bandwidth: {sum(checkpoint_load_bw)/max(len(checkpoint_load_bw), 1):.2f} MB/s\n")
                         f.write(f"Checkpoint size: {sum(checkpoint_size)/len(checkpoint_size) / 1024 / 1024:.2f} MB\n")
                         f.write(f"Chunks number: {num_chunks}\n")
                         f.write(f"Chunks size: {num_chunks * CHUNK_SIZE / 1024 / 1024:.2f} MB\n")
                         f.write(f"Min save time: {min(checkpoint_save_time):.2f}s\n")
                         f.write(f"Max save time: {max(checkpoint_save_time):.2f}s\n")
-                        f.write(f"Min load time: {min(checkpoint_load_time):.2f}s\n")
-                        f.write(f"Max load time: {max(checkpoint_load_time):.2f}s\n")
+                        f.write(f"Min load time: {min(checkpoint_load_time, default=0):.2f}s\n")
+                        f.write(f"Max load time: {max(checkpoint_load_time, default=0):.2f}s\n")
+                        if checkpoint_stall:
+                            f.write(f"Average step stall: {sum(checkpoint_stall)/len(checkpoint_stall):.3f}s\n")
               
                 checkpoint.cleanup()
                 return
@@ -1,4 +1,5 @@
 #include "npu_nvme.h"
+#include "checksum.h"
 #include <acl/acl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,10 +7,20 @@
 #include <stdbool.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #define DEFAULT_PCI_ADDR     "0000:83:00.0"
 #define DEFAULT_PIPE_DEPTH   4
 #define DEFAULT_CHUNK_SIZE   (4 * 1024 * 1024ULL) /* 4MB */
+#define DEFAULT_NUM_WORKERS  1
+#define MAX_TEST_DEVICES     16
+#define SMALL_ITEMS          256
+#define STREAM_ITEMS         32
+#define NUM_TENSORS          5
+#define ZERO_TENSORS         4
+#define SHARD_EPOCHS         2
+#define SHARD_TIMEOUT_MS     10000
 
 static double now_ms(void) {
     struct timeval tv;
@@ -21,24 +32,778 @@ static uint64_t align_up(uint64_t x, uint64_t a) {
     return (x + a - 1) & ~(a - 1);
 }
 
+/* 大量小 item（LayerNorm 权重一类）：NVMe 侧按 4K 对齐紧密排列，
+ * NPU 侧按实际大小紧密排列，每 4 个里有一个恰好 4KB（NPU 与 NVMe 都连续）。
+ * 覆盖合包与连续段合并两条路径；读写都带 CRC32C，合并拷贝跨 item 时
+ * 每个 item 的校验和仍要与主机侧直接计算的一致。返回不匹配的 item 数，<0 表示出错。 */
+static int test_small_items(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    void *ptrs[SMALL_ITEMS];
+    uint64_t offsets[SMALL_ITEMS];
+    size_t sizes[SMALL_ITEMS];
+    uint32_t crcs[SMALL_ITEMS], ref[SMALL_ITEMS];
+    uint8_t mismatch[SMALL_ITEMS];
+    size_t npu_total = 0;
+    uint64_t off = nvme_base;
+    size_t max_xfer = npu_nvme_get_max_transfer(ctx);
+    for (int i = 0; i < SMALL_ITEMS; ++i) {
+        sizes[i] = (i % 4 == 0) ? 4096 : (size_t)(i * 1337 % 12000) + 1;
+        if (sizes[i] > max_xfer) sizes[i] = max_xfer;
+        offsets[i] = off;
+        off += align_up(sizes[i], 4096);
+        npu_total += sizes[i];
+    }
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(npu_total);
+    if (!host || aclrtMalloc(&npu_buf, npu_total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < SMALL_ITEMS; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + pos;
+        memset(host + pos, 0x40 + (i % 64), sizes[i]);
+        host[pos] = (uint8_t)i;
+        ref[i] = cksum_crc32c(0, host + pos, sizes[i]);
+        pos += sizes[i];
+    }
+
+    int errs = -1;
+    if (aclrtMemcpy(npu_buf, npu_total, host, npu_total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch_crc(ctx, ptrs, offsets, sizes, SMALL_ITEMS, crcs) != 0) goto out;
+    memset(host, 0, npu_total);
+    if (aclrtMemcpy(npu_buf, npu_total, host, npu_total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_read_batch_crc(ctx, ptrs, offsets, sizes, SMALL_ITEMS, ref, mismatch) != 0 ||
+        aclrtMemcpy(host, npu_total, npu_buf, npu_total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS) goto out;
+
+    errs = 0;
+    pos = 0;
+    for (int i = 0; i < SMALL_ITEMS; ++i) {
+        if (crcs[i] != ref[i] || mismatch[i] || host[pos] != (uint8_t)i) {
+            errs++;
+            pos += sizes[i];
+            continue;
+        }
+        for (size_t k = 1; k < sizes[i]; ++k) {
+            if (host[pos + k] != 0x40 + (i % 64)) { errs++; break; }
+        }
+        pos += sizes[i];
+    }
+
+out:
+    free(host);
+    aclrtFree(npu_buf);
+    return errs;
+}
+
+/* 超过单条命令上限的大 item：自动拆成多条命令，CRC 仍按整个 item 合并。
+ * 大小取 3.x 条命令且不是 4K 整数倍，末尾带填充。返回 0 成功 */
+static int test_large_item(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    size_t sz = 3 * npu_nvme_get_max_transfer(ctx) + 12345;
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(sz);
+    uint8_t *back = malloc(sz);
+    if (!host || !back || aclrtMalloc(&npu_buf, sz, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        return -1;
+    }
+    for (size_t k = 0; k < sz; ++k) host[k] = (uint8_t)(k * 31 + (k >> 12));
+    uint32_t ref = cksum_crc32c(0, host, sz), crc = 0;
+    uint8_t mismatch = 1;
+
+    int rc = -1;
+    if (aclrtMemcpy(npu_buf, sz, host, sz, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch_crc(ctx, &npu_buf, &nvme_base, &sz, 1, &crc) != 0 || crc != ref) goto out;
+    memset(back, 0, sz);
+    if (aclrtMemcpy(npu_buf, sz, back, sz, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_read_batch_crc(ctx, &npu_buf, &nvme_base, &sz, 1, &ref, &mismatch) != 0 ||
+        aclrtMemcpy(back, sz, npu_buf, sz, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS) goto out;
+    rc = (mismatch || memcmp(host, back, sz) != 0) ? -1 : 0;
+
+out:
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* DMA slab 的三种分配方式各 init 一次：生效的方式应与所选一致（stand-in 下注册总是成功），
+ * 再用跨多条命令的大 item 读写校验。返回 0 成功 */
+static int test_dma_policies(const npu_nvme_opts_t *base_opts, uint64_t nvme_base) {
+    static const int policies[] = { NPU_NVME_DMA_SPDK_REGISTERED, NPU_NVME_DMA_ACL_HOST,
+                                    NPU_NVME_DMA_PAGEABLE };
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+        npu_nvme_opts_t o = *base_opts;
+        o.dma_policy = policies[p];
+        npu_nvme_context_t *ctx = NULL;
+        if (npu_nvme_init_opts(&ctx, &o) != 0) {
+            fprintf(stderr, "[DMA] init failed with policy %d\n", policies[p]);
+            return -1;
+        }
+        int rc = (npu_nvme_get_dma_policy(ctx) == policies[p]) ? test_large_item(ctx, nvme_base) : -1;
+        npu_nvme_cleanup(ctx);
+        if (rc != 0) {
+            fprintf(stderr, "[DMA] policy %d failed\n", policies[p]);
+            return -1;
+        }
+    }
+    printf("[DMA] spdk+registered / acl-host / pageable slabs all round-trip\n");
+    return 0;
+}
+
+/* NUMA：stand-in 控制器节点未知（除非设了 NVME_STANDIN_NUMA），AUTO 时不按节点放置；
+ * 指定节点 0 时生效节点为 0，OFF 时为 -1，两种情况都用大 item 读写校验。返回 0 成功 */
+static int test_numa(const npu_nvme_opts_t *base_opts, uint64_t nvme_base) {
+    static const int nodes[] = { 0, NPU_NVME_NUMA_OFF };
+    for (size_t i = 0; i < sizeof(nodes) / sizeof(nodes[0]); ++i) {
+        npu_nvme_opts_t o = *base_opts;
+        o.numa_node = nodes[i];
+        npu_nvme_context_t *ctx = NULL;
+        if (npu_nvme_init_opts(&ctx, &o) != 0) {
+            fprintf(stderr, "[NUMA] init failed with numa_node %d\n", nodes[i]);
+            return -1;
+        }
+        int want = nodes[i] >= 0 ? nodes[i] : -1;
+        int rc = (npu_nvme_get_numa_node(ctx) == want) ? test_large_item(ctx, nvme_base) : -1;
+        npu_nvme_cleanup(ctx);
+        if (rc != 0) {
+            fprintf(stderr, "[NUMA] numa_node %d failed\n", nodes[i]);
+            return -1;
+        }
+    }
+    printf("[NUMA] pinned-node and unplaced contexts round-trip\n");
+    return 0;
+}
+
+/* 读回 num 个 item 到清过的 NPU 内存，与 host 比较，顺带取本次读的统计。返回 0 成功 */
+static int cache_read_check(npu_nvme_context_t *ctx, void **ptrs, uint64_t *offs, size_t *sizes,
+                            int num, void *npu_buf, const uint8_t *host, uint8_t *back,
+                            size_t total, npu_nvme_dir_stats_t *rd) {
+    npu_nvme_stats_t st;
+    memset(back, 0x5a, total);
+    npu_nvme_reset_stats(ctx);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_read_batch(ctx, ptrs, offs, sizes, num) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        npu_nvme_get_stats(ctx, &st) != 0) return -1;
+    *rd = st.read;
+    return memcmp(host, back, total) == 0 ? 0 : -1;
+}
+
+/* 主机恢复缓存：写 3 个单条命令大小的 item 全部复制进缓存（记为 fill，不算命中），读回应全部命中、没有 NVMe 命令；
+ * 只改写第 3 个 item 的前 4K 会作废它的条目，读回为新数据且至少有一次未命中；
+ * 写超过容量的数据会按 LRU 淘汰，读回仍正确；自动调优的读试验要真的读盘、
+ * 也不能挤掉已缓存的条目；清空后全部读盘。返回 0 成功 */
+static int test_host_cache(const npu_nvme_opts_t *base_opts, uint64_t nvme_base) {
+    npu_nvme_opts_t o = *base_opts;
+    o.host_cache_bytes = 16 << 20;
+    npu_nvme_context_t *ctx = NULL;
+    if (npu_nvme_init_opts(&ctx, &o) != 0) return -1;
+
+    npu_nvme_cache_info_t info;
+    npu_nvme_stats_t st;
+    const size_t x = npu_nvme_get_max_transfer(ctx);
+    const int nslots = (int)((16 << 20) / x);
+    const int num = nslots + 2;
+    const size_t total = (size_t)num * x;
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(total);
+    uint8_t *back = malloc(total);
+    void **ptrs = malloc(sizeof(void *) * num);
+    uint64_t *offs = malloc(sizeof(uint64_t) * num);
+    size_t *sizes = malloc(sizeof(size_t) * num);
+    npu_nvme_dir_stats_t rd;
+    int rc = -1;
+    if (!host || !back || !ptrs || !offs || !sizes ||
+        aclrtMalloc(&npu_buf, total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) goto out;
+    for (int i = 0; i < num; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + (size_t)i * x;
+        offs[i] = nvme_base + (uint64_t)i * x;
+        sizes[i] = x;
+    }
+    for (size_t k = 0; k < total; ++k) host[k] = (uint8_t)(k * 11 + (k >> 13));
+
+    npu_nvme_reset_stats(ctx);
+    if (npu_nvme_get_cache_info(ctx, &info) != 0 || info.capacity != (size_t)nslots * x ||
+        aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch(ctx, ptrs, offs, sizes, 3) != 0 ||
+        npu_nvme_get_stats(ctx, &st) != 0 || st.write.cache_hits != 0 ||
+        st.write.cache_fills != st.write.commands || st.write.cache_fill_bytes != 3 * x ||
+        cache_read_check(ctx, ptrs, offs, sizes, 3, npu_buf, host, back, 3 * x, &rd) != 0 ||
+        rd.commands == 0 || rd.cache_hits != rd.commands ||
+        rd.hist[NPU_NVME_STAGE_NVME].count != 0) {
+        fprintf(stderr, "[Cache] rollback read was not served from the host cache\n");
+        goto out;
+    }
+
+    /* 部分改写：旧条目作废，不能读到旧数据 */
+    size_t page = 4096;
+    for (size_t k = 0; k < page; ++k) host[2 * x + k] = (uint8_t)~host[2 * x + k];
+    if (aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch(ctx, &ptrs[2], &offs[2], &page, 1) != 0 ||
+        cache_read_check(ctx, ptrs, offs, sizes, 3, npu_buf, host, back, 3 * x, &rd) != 0 ||
+        rd.cache_hits >= rd.commands) {
+        fprintf(stderr, "[Cache] overlapping write did not invalidate the cached chunk\n");
+        goto out;
+    }
+
+    /* 超过容量：LRU 淘汰 */
+    if (npu_nvme_write_batch(ctx, ptrs, offs, sizes, num) != 0 ||
+        npu_nvme_get_cache_info(ctx, &info) != 0 || info.evictions == 0 ||
+        info.used > info.capacity ||
+        cache_read_check(ctx, ptrs, offs, sizes, num, npu_buf, host, back, total, &rd) != 0 ||
+        rd.cache_hits == 0 || rd.cache_hits >= rd.commands) {
+        fprintf(stderr, "[Cache] eviction under the memory cap failed\n");
+        goto out;
+    }
+
+    /* 自动调优不经缓存：读试验有 NVMe 命令且无命中，缓存内容不变 */
+    npu_nvme_cache_info_t before = info;
+    npu_nvme_tune_t tune;
+    npu_nvme_reset_stats(ctx);
+    int trc = npu_nvme_autotune(ctx, align_up(nvme_base + total, 1 << 20), 8 << 20, 200, &tune);
+    unlink(getenv("NPU_NVME_TUNE_CACHE"));
+    if (trc != 0 || npu_nvme_get_stats(ctx, &st) != 0 ||
+        st.read.hist[NPU_NVME_STAGE_NVME].count == 0 || st.read.cache_hits != 0 ||
+        npu_nvme_get_cache_info(ctx, &info) != 0 ||
+        info.used != before.used || info.evictions != before.evictions ||
+        info.generation != before.generation) {
+        fprintf(stderr, "[Cache] autotune trials went through the host cache\n");
+        goto out;
+    }
+
+    npu_nvme_cache_clear(ctx);
+    if (npu_nvme_get_cache_info(ctx, &info) != 0 || info.used != 0 ||
+        cache_read_check(ctx, ptrs, offs, sizes, 3, npu_buf, host, back, 3 * x, &rd) != 0 ||
+        rd.cache_hits != 0) {
+        fprintf(stderr, "[Cache] cleared cache still served reads\n");
+        goto out;
+    }
+    printf("[Cache] rollback served from %.1f MB host cache (%s), %llu evictions\n",
+           info.capacity / 1024.0 / 1024.0, info.hugetlb ? "hugetlb" : "thp",
+           (unsigned long long)info.evictions);
+    rc = 0;
+
+out:
+    npu_nvme_cleanup(ctx);
+    free(host);
+    free(back);
+    free(ptrs);
+    free(offs);
+    free(sizes);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* 张量列表：save_tensors 按 4K 布局写，偏移要与 layout_tensors 一致；
+ * 按 64KB 分块的计划读回（item 数 = 各张量向上取整的块数），再用 load_tensors 读一遍。返回 0 成功 */
+static int test_tensors(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    const size_t sizes[NUM_TENSORS] = { 100000, 4096, 300001, 1, 65536 };
+    const size_t chunk = 65536;
+    void *ptrs[NUM_TENSORS];
+    uint64_t offs[NUM_TENSORS], expect[NUM_TENSORS];
+    size_t total = 0;
+    int items = 0;
+    for (int i = 0; i < NUM_TENSORS; ++i) {
+        total += sizes[i];
+        items += (int)((sizes[i] + chunk - 1) / chunk);
+    }
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(total);
+    uint8_t *back = malloc(total);
+    if (!host || !back || aclrtMalloc(&npu_buf, total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < NUM_TENSORS; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + pos;
+        pos += sizes[i];
+    }
+    for (size_t k = 0; k < total; ++k) host[k] = (uint8_t)(k * 13 + (k >> 10));
+
+    int rc = -1, n = 0;
+    npu_nvme_plan_t *plan = NULL;
+    uint64_t span = npu_nvme_layout_tensors(sizes, NUM_TENSORS, nvme_base, expect);
+    if (span != 4096 * (25 + 1 + 74 + 1 + 16) ||
+        aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_save_tensors(ctx, ptrs, sizes, NUM_TENSORS, nvme_base, offs) != 0 ||
+        memcmp(offs, expect, sizeof(offs)) != 0) goto out;
+
+    memset(back, 0, total);
+    plan = npu_nvme_plan_create_tensors(ctx, ptrs, offs, sizes, NUM_TENSORS, chunk, &n);
+    if (!plan || n != items ||
+        aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_plan_execute_read(plan) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+
+    memset(back, 0, total);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_load_tensors(ctx, ptrs, sizes, NUM_TENSORS, nvme_base, NULL) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+    rc = 0;
+
+out:
+    npu_nvme_plan_destroy(plan);
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* 全零检测：按单条命令切块，t0 前一块为零、t1 全零、t2 除 5 字节尾块外为零（尾块与 t3 同一条命令）。
+ * 写后全零字节数应为 3 块；盘上确实是 0。再把盘上 t1 改成垃圾，另一个计划加载清单后读回
+ * 仍是 0（说明没有读盘），CRC 也对得上。条带化时只检查有零块、读回正确。返回 0 成功 */
+static int test_zero(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    const size_t x = npu_nvme_get_max_transfer(ctx);
+    size_t sizes[ZERO_TENSORS] = { 2 * x, x, x + 5, 4096 };
+    const char *manifest = "test_npu_nvme_zero_manifest.csv";
+    /* 条带化时同一设备上相邻条带会并进一条命令，与非零数据混在一起的零块不算 */
+    const bool striped = npu_nvme_get_num_devices(ctx) > 1;
+    void *ptrs[ZERO_TENSORS];
+    uint64_t offs[ZERO_TENSORS];
+    size_t total = 0;
+    for (int i = 0; i < ZERO_TENSORS; ++i) total += sizes[i];
+
+    void *npu_buf = NULL;
+    uint8_t *host = calloc(1, total);
+    uint8_t *back = malloc(total);
+    if (!host || !back || aclrtMalloc(&npu_buf, total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < ZERO_TENSORS; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + pos;
+        pos += sizes[i];
+    }
+    for (size_t k = x; k < 2 * x; ++k) host[k] = (uint8_t)(k * 7 + 1);
+    for (size_t k = total - 4096; k < total; ++k) host[k] = (uint8_t)(k * 3 + 2);
+
+    int rc = -1, n = 0, n2 = 0;
+    uint64_t zero_bytes = 0;
+    uint32_t *crcs = NULL;
+    npu_nvme_plan_t *wplan = NULL, *rplan = NULL;
+    if (aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_save_tensors(ctx, ptrs, sizes, ZERO_TENSORS, nvme_base, offs) != 0) goto out;
+    wplan = npu_nvme_plan_create_tensors(ctx, ptrs, offs, sizes, ZERO_TENSORS, x, &n);
+    crcs = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    if (!wplan || !crcs || npu_nvme_plan_set_zero_detect(wplan, true) != 0 ||
+        npu_nvme_plan_set_checksum(wplan, true) != 0 ||
+        npu_nvme_plan_execute_write(wplan) != 0 ||
+        npu_nvme_plan_get_zero_stats(wplan, &zero_bytes) != 0 || zero_bytes == 0 ||
+        (striped ? zero_bytes > 3 * x + 4096 : zero_bytes != 3 * x) ||
+        npu_nvme_plan_get_checksums(wplan, crcs) != 0 ||
+        npu_nvme_plan_save_manifest(wplan, manifest) != 0) goto out;
+
+    /* 普通读：盘上的全零区间读出来就是 0 */
+    memset(back, 0xab, total);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_load_tensors(ctx, ptrs, sizes, ZERO_TENSORS, nvme_base, offs) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+
+    /* 盘上 t1 写成垃圾：按清单跳过的读不会看到它 */
+    memset(back, 0xcd, total);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        (!striped && npu_nvme_write_batch(ctx, &ptrs[1], &offs[1], &sizes[1], 1) != 0))
+        goto out;
+    rplan = npu_nvme_plan_create_tensors(ctx, ptrs, offs, sizes, ZERO_TENSORS, x, &n2);
+    if (!rplan || n2 != n || npu_nvme_plan_set_zero_detect(rplan, true) != 0 ||
+        npu_nvme_plan_load_manifest(rplan, manifest) != 0 ||
+        npu_nvme_plan_set_expected_checksums(rplan, crcs) != 0 ||
+        npu_nvme_plan_execute_read(rplan) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+    rc = 0;
+
+out:
+    remove(manifest);
+    npu_nvme_plan_destroy(wplan);
+    npu_nvme_plan_destroy(rplan);
+    free(crcs);
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* 快照后排空：暂存区只放得下前两个张量。take 之后立刻改写原参数（模拟 optimizer.step），
+ * 暂存的两个异步写盘、第三个在改写前直接写盘，读回必须是 take 时的内容。返回 0 成功 */
+static int test_snapshot(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    const size_t sizes[3] = { 200000, 8192, 70000 };
+    const size_t total = sizes[0] + sizes[1] + sizes[2];
+    void *ptrs[3], *staged[3] = { NULL, NULL, NULL };
+    uint64_t offs[3];
+    npu_nvme_layout_tensors(sizes, 3, nvme_base, offs);
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(total);
+    uint8_t *back = malloc(total);
+    npu_nvme_snapshot_t *snap = npu_nvme_snapshot_create(ctx, align_up(sizes[0], 4096) + sizes[1]);
+    if (!host || !back || !snap ||
+        aclrtMalloc(&npu_buf, total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        npu_nvme_snapshot_destroy(snap);
+        return -1;
+    }
+    ptrs[0] = npu_buf;
+    ptrs[1] = (uint8_t *)npu_buf + sizes[0];
+    ptrs[2] = (uint8_t *)npu_buf + sizes[0] + sizes[1];
+    for (size_t k = 0; k < total; ++k) host[k] = (uint8_t)(k * 29 + 3);
+
+    int rc = -1;
+    npu_nvme_handle_t *h = NULL;
+    if (aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_snapshot_take(snap, ptrs, sizes, 3, staged) != 2) goto out;
+    h = npu_nvme_write_async(ctx, staged, offs, (size_t *)sizes, 2, NULL, NULL);
+    if (!h || npu_nvme_write_batch(ctx, &ptrs[2], &offs[2], (size_t *)&sizes[2], 1) != 0) goto out;
+    memset(back, 0xee, total);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_wait(h, 10000) != 0) goto out;
+
+    if (npu_nvme_load_tensors(ctx, ptrs, sizes, 3, nvme_base, NULL) != 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+    rc = 0;
+
+out:
+    npu_nvme_handle_free(h);
+    npu_nvme_snapshot_destroy(snap);
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* 空间管理：16 个 256KB 的块。多个 tenant / 版本互不重叠且连续放置，
+ * 重新打开后已提交的版本还在、未提交的被回收，retain / free 之后腾出的块能再分配。返回 0 成功 */
+static int test_space(npu_nvme_context_t *ctx, uint64_t nvme_base) {
+    const uint64_t unit = 256 << 10;
+    const uint64_t len = NPU_NVME_SPACE_META_BYTES + 16 * unit;
+    const uint64_t data = nvme_base + NPU_NVME_SPACE_META_BYTES;
+    size_t sz = 600000;
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(sz);
+    uint8_t *back = malloc(sz);
+    if (!host || !back || aclrtMalloc(&npu_buf, sz, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        return -1;
+    }
+    for (size_t k = 0; k < sz; ++k) host[k] = (uint8_t)(k * 13 + 5);
+
+    int rc = -1;
+    npu_nvme_space_t *sp = NULL;
+    npu_nvme_extent_t a1, a2, b3, b4, c1, c2, e, list[4];
+    npu_nvme_space_stats_t st;
+    npu_nvme_stats_t ns;
+    if (npu_nvme_space_open(ctx, nvme_base, len, unit, &sp) != 0) goto out;
+
+    /* a: 3 块 + 1 块，b: 4 块，按顺序紧挨着放 */
+    if (npu_nvme_space_alloc(sp, "a", sz, &a1) != 0 || a1.offset != data || a1.bytes != 3 * unit ||
+        aclrtMemcpy(npu_buf, sz, host, sz, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch(ctx, &npu_buf, &a1.offset, &sz, 1) != 0 ||
+        npu_nvme_space_commit(sp, "a", a1.version) != 0 ||
+        npu_nvme_space_alloc(sp, "a", 4096, &a2) != 0 || a2.offset != data + 3 * unit ||
+        npu_nvme_space_commit(sp, "a", a2.version) != 0 ||
+        npu_nvme_space_alloc(sp, "b", 4 * unit, &b3) != 0 || b3.offset != data + 4 * unit ||
+        npu_nvme_space_commit(sp, "b", b3.version) != 0 ||
+        npu_nvme_space_alloc(sp, "b", 2 * unit, &b4) != 0 ||
+        !(a1.version < a2.version && a2.version < b3.version && b3.version < b4.version))
+        goto out;
+    npu_nvme_space_close(sp);
+    sp = NULL;
+
+    /* 重新打开：b 未提交的版本被回收，a 的数据还在 */
+    memset(back, 0, sz);
+    if (npu_nvme_space_open(ctx, nvme_base, 0, 0, &sp) != 0 ||
+        npu_nvme_space_find(sp, "b", b4.version, &e) == 0 ||
+        npu_nvme_space_find(sp, "b", 0, &e) != 0 || e.version != b3.version ||
+        npu_nvme_space_find(sp, "a", 0, &e) != 0 || e.version != a2.version ||
+        npu_nvme_space_find(sp, "a", a1.version, &e) != 0 || e.offset != a1.offset ||
+        aclrtMemcpy(npu_buf, sz, back, sz, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_read_batch(ctx, &npu_buf, &e.offset, &sz, 1) != 0 ||
+        aclrtMemcpy(back, sz, npu_buf, sz, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, sz) != 0)
+        goto out;
+
+    /* a 只留最新的一个，b 全部释放；放不下时等回收完成再分配。
+     * 回收的 Deallocate 单独计数，写方向的命令数仍与直方图样本数一致 */
+    npu_nvme_reset_stats(ctx);
+    if (npu_nvme_space_retain(sp, "a", 1) != 1 ||
+        npu_nvme_space_find(sp, "a", a1.version, &e) == 0 ||
+        npu_nvme_space_free(sp, "b", b3.version) != 0 ||
+        npu_nvme_space_alloc(sp, "c", 64 << 20, &e) != NPU_NVME_ERR_NOSPACE ||
+        npu_nvme_space_alloc(sp, "c", 12 * unit, &c1) != 0 || c1.offset != data + 4 * unit ||
+        npu_nvme_space_alloc(sp, "c", 3 * unit, &c2) != 0 || c2.offset != data ||
+        npu_nvme_space_alloc(sp, "c", 4096, &e) != NPU_NVME_ERR_NOSPACE ||
+        npu_nvme_space_get_stats(sp, &st) != 0 || st.total_bytes != 16 * unit ||
+        st.used_bytes != st.total_bytes || st.largest_free != 0 || st.num_extents != 3 ||
+        npu_nvme_space_list(sp, "c", list, 4) != 2 || list[0].version != c2.version ||
+        npu_nvme_space_list(sp, NULL, list, 4) != 3 ||
+        npu_nvme_get_stats(ctx, &ns) != 0 || ns.trims == 0 ||
+        ns.write.hist[NPU_NVME_STAGE_NVME].count != ns.write.commands ||
+        ns.write.hist[NPU_NVME_STAGE_E2E].count != ns.write.commands)
+        goto out;
+    rc = 0;
+
+out:
+    npu_nvme_space_close(sp);
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* 每个 item 只会在一个 worker 里通知一次，各自计数不需要加锁 */
+static void stream_ready_cb(npu_nvme_handle_t *h, int item, int status, void *arg) {
+    (void)h;
+    if (status == 0) ((int *)arg)[item]++;
+}
+
+/* 优先级流式读：item 在盘上顺序排列，按相反的优先级读回（最后一个最先）。
+ * 每个 item 都要恰好通知一次并能单独等到，数据与写入一致。单个 worker 时
+ * 就绪顺序必须与优先级一致；多个 worker 线程的先后取决于调度，不比较。返回 0 成功，*first_ms / *total_ms 为最高优先级 item 与全部 item 的就绪时间 */
+static int test_stream(npu_nvme_context_t *ctx, uint64_t nvme_base, double *first_ms,
+                       double *total_ms) {
+    void *ptrs[STREAM_ITEMS];
+    uint64_t offsets[STREAM_ITEMS], ready_ns[STREAM_ITEMS];
+    size_t sizes[STREAM_ITEMS];
+    int prio[STREAM_ITEMS], notified[STREAM_ITEMS];
+    size_t total = 0;
+    uint64_t off = nvme_base;
+    for (int i = 0; i < STREAM_ITEMS; ++i) {
+        sizes[i] = 65536 + (size_t)i * 1000;
+        offsets[i] = off;
+        off += align_up(sizes[i], 4096);
+        prio[i] = STREAM_ITEMS - 1 - i;
+        notified[i] = 0;
+        total += sizes[i];
+    }
+
+    void *npu_buf = NULL;
+    uint8_t *host = malloc(total);
+    uint8_t *back = malloc(total);
+    if (!host || !back || aclrtMalloc(&npu_buf, total, ACL_MEM_MALLOC_HUGE_FIRST) != ACL_SUCCESS) {
+        free(host);
+        free(back);
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < STREAM_ITEMS; ++i) {
+        ptrs[i] = (uint8_t *)npu_buf + pos;
+        for (size_t k = 0; k < sizes[i]; ++k) host[pos + k] = (uint8_t)(i * 7 + k);
+        pos += sizes[i];
+    }
+
+    int rc = -1;
+    npu_nvme_handle_t *h = NULL;
+    if (aclrtMemcpy(npu_buf, total, host, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS ||
+        npu_nvme_write_batch(ctx, ptrs, offsets, sizes, STREAM_ITEMS) != 0) goto out;
+    memset(back, 0, total);
+    if (aclrtMemcpy(npu_buf, total, back, total, ACL_MEMCPY_HOST_TO_DEVICE) != ACL_SUCCESS) goto out;
+
+    h = npu_nvme_read_stream(ctx, ptrs, offsets, sizes, STREAM_ITEMS, prio,
+                             stream_ready_cb, notified, NULL, NULL);
+    if (!h) goto out;
+    for (int i = STREAM_ITEMS - 1; i >= 0; --i) {
+        if (npu_nvme_stream_wait(h, i, 10000, &ready_ns[i]) != 0) goto out;
+    }
+    if (npu_nvme_wait(h, 10000) != 0 ||
+        npu_nvme_stream_wait(h, STREAM_ITEMS, 0, NULL) >= 0 ||
+        aclrtMemcpy(back, total, npu_buf, total, ACL_MEMCPY_DEVICE_TO_HOST) != ACL_SUCCESS ||
+        memcmp(host, back, total) != 0) goto out;
+    uint64_t last = 0;
+    for (int i = 0; i < STREAM_ITEMS; ++i) {
+        if (notified[i] != 1) goto out;
+        if (npu_nvme_get_num_workers(ctx) == 1 && i > 0 && ready_ns[i] > ready_ns[i - 1]) goto out;
+        if (ready_ns[i] > last) last = ready_ns[i];
+    }
+    *first_ms = ready_ns[STREAM_ITEMS - 1] / 1e6;
+    *total_ms = last / 1e6;
+    rc = 0;
+
+out:
+    npu_nvme_handle_free(h);
+    free(host);
+    free(back);
+    aclrtFree(npu_buf);
+    return rc;
+}
+
+/* rank r 在第 e 个 epoch 的分片大小与内容：两个 epoch 大小顺序相反，各 rank 内容不同，
+ * 区域算错、重叠或被别的 rank 覆盖都能在读回时发现 */
+static size_t shard_size(int rank, int ranks, uint64_t epoch) {
+    int k = (epoch % 2) ? rank : ranks - 1 - rank;
+    return (size_t)(k + 1) * 300 * 1024 + (size_t)rank * 4096 + 123;
+}
+
+static uint8_t shard_byte(int rank, uint64_t epoch, size_t k) {
+    return (uint8_t)(rank * 37 + epoch * 11 + k * 7 + (k >> 12));
+}
+
+static int shard_init(npu_nvme_context_t **ctx, const char **addrs, int num_devices, int shm_id) {
+    npu_nvme_opts_t o;
+    npu_nvme_opts_init(&o);
+    o.nvme_pci_addrs = addrs;
+    o.num_devices = num_devices;
+    o.chunk_size = 256 * 1024;
+    o.shm_id = shm_id;
+    return npu_nvme_init_opts(ctx, &o);
+}
+
+/* 一个 rank（子进程）：每个 epoch 划分区域、写自己的分片、提交 */
+static int shard_rank_main(const char **addrs, int num_devices, int shm_id, uint64_t job,
+                           int rank, int ranks) {
+    npu_nvme_context_t *ctx = NULL;
+    if (shard_init(&ctx, addrs, num_devices, shm_id) != 0) return 1;
+    int rc = 0;
+    for (uint64_t e = 1; rc == 0 && e <= SHARD_EPOCHS; ++e) {
+        size_t sz = shard_size(rank, ranks, e);
+        npu_nvme_shard_layout_t lay;
+        void *npu = NULL;
+        uint8_t *host = malloc(sz);
+        rc = (host && aclrtMalloc(&npu, sz, ACL_MEM_MALLOC_HUGE_FIRST) == ACL_SUCCESS) ? 0 : -1;
+        if (rc == 0) rc = npu_nvme_shard_plan(ctx, 0, job, e, rank, ranks, sz, SHARD_TIMEOUT_MS, &lay);
+        if (rc == 0) {
+            for (size_t k = 0; k < sz; ++k) host[k] = shard_byte(rank, e, k);
+            rc = aclrtMemcpy(npu, sz, host, sz, ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, &npu, &lay.offset[rank], &sz, 1);
+        if (rc == 0) rc = npu_nvme_shard_commit(ctx, 0, &lay, rank, SHARD_TIMEOUT_MS);
+        free(host);
+        aclrtFree(npu);
+    }
+    npu_nvme_cleanup(ctx);
+    return rc == 0 ? 0 : 1;
+}
+
+/* 多 rank 分片：ranks 个进程以相同 shm_id 共用盘（stand-in 下为 /dev/shm 里的文件），
+ * 各自保存两个 epoch；全部退出后由本进程按全局清单读回每个 rank 的分片并比对 */
+static int test_sharded(const char **addrs, int num_devices, int ranks) {
+    int shm_id = (int)(getpid() % 32768);
+    uint64_t job = (uint64_t)getpid();
+    pid_t pids[NPU_NVME_MAX_RANKS];
+    int failed = 0, started = 0;
+
+    fflush(stdout);
+    for (int r = 0; r < ranks; ++r) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int rc = shard_rank_main(addrs, num_devices, shm_id, job, r, ranks);
+            fflush(stdout);
+            _exit(rc);
+        }
+        if (pid < 0) {
+            failed++;
+            break;
+        }
+        pids[started++] = pid;
+    }
+    for (int r = 0; r < started; ++r) {
+        int st = 0;
+        if (waitpid(pids[r], &st, 0) < 0 || !WIFEXITED(st) || WEXITSTATUS(st) != 0) failed++;
+    }
+
+    npu_nvme_context_t *ctx = NULL;
+    npu_nvme_shard_layout_t lay;
+    if (failed == 0 && (shard_init(&ctx, addrs, num_devices, shm_id) != 0 ||
+                        npu_nvme_shard_open(ctx, 0, &lay) != 0 ||
+                        lay.epoch != SHARD_EPOCHS || lay.world_size != ranks)) {
+        fprintf(stderr, "[Shard] no global manifest for epoch %d\n", SHARD_EPOCHS);
+        failed++;
+    }
+    uint64_t end = NPU_NVME_SHARD_TABLE_BYTES;
+    for (int r = 0; failed == 0 && r < ranks; ++r) {
+        size_t sz = shard_size(r, ranks, SHARD_EPOCHS);
+        void *npu = NULL;
+        uint8_t *host = malloc(sz);
+        bool ok = host && lay.shard_bytes[r] == sz && lay.offset[r] >= end &&
+                  lay.offset[r] % (1024 * 1024) == 0 && lay.len[r] >= sz &&
+                  aclrtMalloc(&npu, sz, ACL_MEM_MALLOC_HUGE_FIRST) == ACL_SUCCESS &&
+                  npu_nvme_read_batch(ctx, &npu, &lay.offset[r], &sz, 1) == 0 &&
+                  aclrtMemcpy(host, sz, npu, sz, ACL_MEMCPY_DEVICE_TO_HOST) == ACL_SUCCESS;
+        for (size_t k = 0; ok && k < sz; ++k) ok = host[k] == shard_byte(r, SHARD_EPOCHS, k);
+        if (!ok) {
+            fprintf(stderr, "[Shard] rank %d shard wrong at offset %lu\n", r, lay.offset[r]);
+            failed++;
+        }
+        end = lay.offset[r] + lay.len[r];
+        free(host);
+        aclrtFree(npu);
+    }
+    npu_nvme_cleanup(ctx);
+
+    for (int d = 0; d < num_devices; ++d) {
+        char path[320];
+        snprintf(path, sizeof(path), "/dev/shm/npu_nvme_standin.%d.%s", shm_id, addrs[d]);
+        unlink(path);
+    }
+    if (failed) return -1;
+    printf("[Shard] %d ranks x %d epochs on a shared device, shards read back ok\n",
+           ranks, SHARD_EPOCHS);
+    return 0;
+}
+
+static void async_done_cb(npu_nvme_handle_t *h, int status, void *arg) {
+    (void)h;
+    *(int *)arg = (status == 0) ? 1 : -1;
+}
+
 int main(int argc, char **argv) {
     const char *nvme_addr = (argc > 1) ? argv[1] : DEFAULT_PCI_ADDR;
     int npu_device_id   = (argc > 2) ? atoi(argv[2]) : 0;
     int pipeline_depth    = (argc > 3) ? atoi(argv[3]) : DEFAULT_PIPE_DEPTH;
     size_t req_chunk_size = (argc > 4) ? strtoull(argv[4], NULL, 10) : DEFAULT_CHUNK_SIZE;
+    int num_workers       = (argc > 5) ? atoi(argv[5]) : DEFAULT_NUM_WORKERS;
+    size_t stripe_unit    = (argc > 6) ? strtoull(argv[6], NULL, 10) : 0;
+    int num_ranks         = (argc > 7) ? atoi(argv[7]) : 0;
     bool enable_profile = false;
 
+    /* 逗号分隔的多个地址：条带到多个设备 */
+    char addr_buf[1024];
+    const char *addrs[MAX_TEST_DEVICES];
+    int num_devices = 0;
+    snprintf(addr_buf, sizeof(addr_buf), "%s", nvme_addr);
+    for (char *save = NULL, *tok = strtok_r(addr_buf, ",", &save);
+         tok && num_devices < MAX_TEST_DEVICES;
+         tok = strtok_r(NULL, ",", &save)) {
+        addrs[num_devices++] = tok;
+    }
+
     printf("======================================\n");
     printf("NPU-NVMe Batch Test\n");
     printf("PCIe addr      : %s\n", nvme_addr);
-    printf("pipeline depth : %d\n", pipeline_depth);
+    printf("queue depth    : %d\n", pipeline_depth);
+    printf("workers        : %d\n", num_workers);
+    printf("devices        : %d (stripe unit %zu)\n", num_devices, stripe_unit);
     printf("req chunk size : %zu bytes (%.2f MB)\n",
            req_chunk_size, req_chunk_size / 1024.0 / 1024.0);
     printf("======================================\n\n");
 
+    /* 多 rank 分片单独成一个测试：各 rank 在子进程里各自 init */
+    if (num_ranks > 0) {
+        if (num_ranks > NPU_NVME_MAX_RANKS) num_ranks = NPU_NVME_MAX_RANKS;
+        return test_sharded(addrs, num_devices, num_ranks) == 0 ? 0 : 1;
+    }
+
+    /* 调优缓存写到临时文件，不读也不改用户的缓存 */
+    char tune_cache[64];
+    snprintf(tune_cache, sizeof(tune_cache), "/tmp/npu_nvme_tune.%d", (int)getpid());
+    setenv("NPU_NVME_TUNE_CACHE", tune_cache, 1);
+
     /* Init */
     npu_nvme_context_t *ctx = NULL;
-    if (npu_nvme_init(&ctx, nvme_addr, npu_device_id, pipeline_depth, req_chunk_size)) {
+    if (npu_nvme_init_striped(&ctx, addrs, num_devices, stripe_unit, npu_device_id,
+                              pipeline_depth, req_chunk_size, num_workers, enable_profile)) {
         fprintf(stderr, "Initialization failed\n");
         return 1;
     }
@@ -188,10 +953,370 @@ int main(int argc, char **argv) {
         if (host_verify[off2 + i] != 0x33) { errs++; break; }
     }
 
+    /* 传输计划：同一布局创建一次，重复执行写/读 */
     if (errs == 0) {
-        printf("\n[Verify] ✓ Data verification passed!\n");
-    } else {
-        printf("\n[Verify] ✗ Data verification failed (mismatches found)\n");
+        npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, write_ptrs, offsets, sizes, 3);
+        rc = plan ? 0 : -1;
+        for (int r = 0; r < 2 && rc == 0; ++r) rc = npu_nvme_plan_execute_write(plan);
+        if (rc == 0) {
+            memset(host_verify, 0, npu_alloc);
+            rc = aclrtMemcpy(npu_buf, npu_alloc, host_verify, npu_alloc,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+        if (rc == 0) {
+            rc = aclrtMemcpy(host_verify, npu_alloc, npu_buf, npu_alloc,
+                             ACL_MEMCPY_DEVICE_TO_HOST) == ACL_SUCCESS ? 0 : -1;
+        }
+        npu_nvme_plan_destroy(plan);
+        if (rc != 0 ||
+            host_verify[off0] != 0x11 || host_verify[off0 + sz0 - 1] != 0x11 ||
+            host_verify[off1] != 0x22 || host_verify[off1 + sz1 - 1] != 0x22 ||
+            host_verify[off2] != 0x33 || host_verify[off2 + sz2 - 1] != 0x33) {
+            fprintf(stderr, "[Plan] plan write/read round trip failed\n");
+            errs++;
+        } else {
+            printf("[Plan] plan write x2 + read round trip ok\n");
+        }
+    }
+
+    /* 增量写：未变化的 segment 跳过，改动过的重写 */
+    if (errs == 0) {
+        uint64_t written[4] = { 0 }, skipped[4] = { 0 };
+        uint8_t *patch = malloc(sz1);
+        npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, write_ptrs, offsets, sizes, 3);
+        rc = (plan && patch && npu_nvme_plan_set_incremental(plan, true) == 0) ? 0 : -1;
+        for (int r = 0; r < 4 && rc == 0; ++r) {
+            /* 第 3 次写前把 item 1 改成 0x55，第 4 次写前改回 0x22 */
+            if (r >= 2) {
+                memset(patch, r == 2 ? 0x55 : 0x22, sz1);
+                rc = aclrtMemcpy(write_ptrs[1], sz1, patch, sz1,
+                                 ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+            }
+            if (rc == 0) rc = npu_nvme_plan_execute_write(plan);
+            if (rc == 0) rc = npu_nvme_plan_get_delta_stats(plan, &written[r], &skipped[r]);
+        }
+        npu_nvme_plan_destroy(plan);
+        free(patch);
+        /* 条带化时一个 segment 可能横跨多个 item，所以不要求第 3 次写有跳过 */
+        if (rc != 0 || skipped[0] != 0 || written[1] != 0 ||
+            written[2] == 0 || written[3] != written[2]) {
+            fprintf(stderr, "[Delta] unexpected incremental stats\n");
+            errs++;
+        } else {
+            printf("[Delta] full %lu B, unchanged %lu B skipped, patch rewrote %lu B\n",
+                   written[0], skipped[1], written[2]);
+        }
+    }
+
+    /* 压缩：一个计划写，另一个同布局计划通过清单拿到压缩长度后读回 */
+    if (errs == 0) {
+        const char *manifest = "test_npu_nvme_manifest.csv";
+        int elem_sizes[3] = { 2, 2, 4 };
+        uint64_t raw = 0, stored = 0;
+        npu_nvme_plan_t *wplan = npu_nvme_plan_create(ctx, write_ptrs, offsets, sizes, 3);
+        npu_nvme_plan_t *rplan = npu_nvme_plan_create(ctx, read_ptrs, offsets, sizes, 3);
+        rc = (wplan && rplan &&
+              npu_nvme_plan_set_compression(wplan, NPU_NVME_CODEC_LZ4, elem_sizes) == 0 &&
+              npu_nvme_plan_set_compression(rplan, NPU_NVME_CODEC_LZ4, elem_sizes) == 0) ? 0 : -1;
+        if (rc == 0) rc = npu_nvme_plan_execute_write(wplan);
+        if (rc == 0) rc = npu_nvme_plan_get_compress_stats(wplan, &raw, &stored);
+        if (rc == 0) rc = npu_nvme_plan_save_manifest(wplan, manifest);
+        if (rc == 0) rc = npu_nvme_plan_load_manifest(rplan, manifest);
+        if (rc == 0) {
+            memset(host_verify, 0, npu_alloc);
+            rc = aclrtMemcpy(npu_buf, npu_alloc, host_verify, npu_alloc,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_plan_execute_read(rplan);
+        if (rc == 0) {
+            rc = aclrtMemcpy(host_verify, npu_alloc, npu_buf, npu_alloc,
+                             ACL_MEMCPY_DEVICE_TO_HOST) == ACL_SUCCESS ? 0 : -1;
+        }
+        npu_nvme_plan_destroy(wplan);
+        npu_nvme_plan_destroy(rplan);
+        remove(manifest);
+        if (rc != 0 || stored >= raw ||
+            host_verify[off0] != 0x11 || host_verify[off0 + sz0 - 1] != 0x11 ||
+            host_verify[off1] != 0x22 || host_verify[off1 + sz1 - 1] != 0x22 ||
+            host_verify[off2] != 0x33 || host_verify[off2 + sz2 - 1] != 0x33) {
+            fprintf(stderr, "[Compress] compressed write/read round trip failed\n");
+            errs++;
+        } else {
+            printf("[Compress] %lu B stored as %lu B, round trip ok\n", raw, stored);
+        }
+    }
+
+    /* 校验：带 CRC 写入后绕过校验改写 item 1，计划读回时只有 item 1 报告不一致 */
+    if (errs == 0) {
+        uint32_t crcs[3] = { 0 };
+        uint8_t mismatch[3] = { 0 };
+        uint8_t *patch = malloc(sz1);
+        npu_nvme_plan_t *plan = npu_nvme_plan_create(ctx, read_ptrs, offsets, sizes, 3);
+        rc = (patch && plan) ? npu_nvme_write_batch_crc(ctx, write_ptrs, offsets, sizes, 3, crcs) : -1;
+        if (rc == 0) {
+            memset(patch, 0x22, sz1);
+            if (crcs[1] != cksum_crc32c(0, patch, sz1)) rc = -1;
+        }
+        if (rc == 0) {
+            memset(patch, 0x55, sz1);
+            rc = aclrtMemcpy(write_ptrs[1], sz1, patch, sz1,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, &write_ptrs[1], &offsets[1], &sizes[1], 1);
+        if (rc == 0) rc = npu_nvme_plan_set_expected_checksums(plan, crcs);
+        if (rc == 0 && (npu_nvme_plan_execute_read(plan) != NPU_NVME_ERR_CHECKSUM ||
+                        npu_nvme_plan_get_mismatches(plan, mismatch) != 1 ||
+                        mismatch[0] || !mismatch[1] || mismatch[2])) rc = -1;
+        /* 恢复 item 1，后面的测试仍按原始模式校验 */
+        if (rc == 0) {
+            memset(patch, 0x22, sz1);
+            rc = aclrtMemcpy(write_ptrs[1], sz1, patch, sz1,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, &write_ptrs[1], &offsets[1], &sizes[1], 1);
+        if (rc == 0) rc = npu_nvme_plan_execute_read(plan);
+        npu_nvme_plan_destroy(plan);
+        free(patch);
+        if (rc != 0) {
+            fprintf(stderr, "[Checksum] crc32c mismatch detection failed\n");
+            errs++;
+        } else {
+            printf("[Checksum] corrupted item detected, clean read verified (hw=%d)\n",
+                   cksum_crc32c_hw());
+        }
+    }
+
+    /* 盘上 checkpoint：连续保存两代，写坏最新一代的超级块后重新扫描应回到上一代 */
+    if (errs == 0) {
+        uint64_t base = align_up(total_span, 1 << 20) + (16ULL << 20);
+        uint64_t slot_size = align_up(2 * total_span, 1 << 20);
+        size_t one_block = 4096;
+        npu_nvme_tensor_t t[4], found[4];
+        void *ckpt_ptrs[4] = { write_ptrs[0], write_ptrs[1], write_ptrs[2], npu_buf };
+        uint8_t *patch = malloc(sz1);
+        npu_nvme_ckpt_t *ck = NULL, *ck2 = NULL;
+        memset(t, 0, sizeof(t));
+        for (int i = 0; i < 4; ++i) {
+            /* 最后一个张量覆盖整块 NPU buffer，大于单条命令上限，保存时会被切开 */
+            snprintf(t[i].name, sizeof(t[i].name), i < 3 ? "layer.%d.weight" : "flat", i);
+            snprintf(t[i].dtype, sizeof(t[i].dtype), "torch.bfloat16");
+            t[i].ndim = 1;
+            t[i].size = i < 3 ? sizes[i] : npu_alloc;
+            t[i].shape[0] = (int64_t)(t[i].size / 2);
+        }
+        rc = (patch && npu_nvme_ckpt_open(ctx, base, 2, slot_size, &ck) == 0) ? 0 : -1;
+        if (rc == 0) rc = npu_nvme_ckpt_save(ck, t, ckpt_ptrs, 4);
+        if (rc == 0) {
+            memset(patch, 0x55, sz1);
+            rc = aclrtMemcpy(write_ptrs[1], sz1, patch, sz1,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_ckpt_save(ck, t, ckpt_ptrs, 4);
+        if (rc == 0) rc = npu_nvme_ckpt_open(ctx, base, 0, 0, &ck2);
+        if (rc == 0 && (npu_nvme_ckpt_generation(ck2) != 2 ||
+                        npu_nvme_ckpt_get_tensors(ck2, found, 4) != 4 ||
+                        strcmp(found[1].name, "layer.1.weight") != 0 ||
+                        found[3].size != npu_alloc)) rc = -1;
+        npu_nvme_ckpt_close(ck2);
+        ck2 = NULL;
+        /* 第 2 代在 1 号 slot，清单在 slot 开头：盖掉它后退回第 1 代 */
+        uint64_t mf_off = base + 2 * 4096 + slot_size;
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, &write_ptrs[1], &mf_off, &one_block, 1);
+        if (rc == 0) rc = npu_nvme_ckpt_open(ctx, base, 0, 0, &ck2);
+        if (rc == 0 && (npu_nvme_ckpt_generation(ck2) != 1 ||
+                        npu_nvme_ckpt_get_tensors(ck2, found, 4) != 4)) rc = -1;
+        npu_nvme_ckpt_close(ck2);
+        ck2 = NULL;
+        /* 第 2 代的超级块在 0 号副本，用 0x55 数据盖掉模拟提交时断电 */
+        if (rc == 0) rc = npu_nvme_write_batch(ctx, &write_ptrs[1], &base, &one_block, 1);
+        if (rc == 0) rc = npu_nvme_ckpt_open(ctx, base, 0, 0, &ck2);
+        if (rc == 0 && (npu_nvme_ckpt_generation(ck2) != 1 ||
+                        npu_nvme_ckpt_get_tensors(ck2, found, 4) != 4)) rc = -1;
+        if (rc == 0) {
+            memset(host_verify, 0, npu_alloc);
+            rc = aclrtMemcpy(npu_buf, npu_alloc, host_verify, npu_alloc,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) rc = npu_nvme_ckpt_load(ck2, found, read_ptrs, 3, NULL);
+        if (rc == 0) {
+            rc = aclrtMemcpy(host_verify, npu_alloc, npu_buf, npu_alloc,
+                             ACL_MEMCPY_DEVICE_TO_HOST) == ACL_SUCCESS ? 0 : -1;
+        }
+        npu_nvme_ckpt_close(ck);
+        npu_nvme_ckpt_close(ck2);
+        free(patch);
+        if (rc != 0 ||
+            host_verify[off0] != 0x11 || host_verify[off0 + sz0 - 1] != 0x11 ||
+            host_verify[off1] != 0x22 || host_verify[off1 + sz1 - 1] != 0x22 ||
+            host_verify[off2] != 0x33 || host_verify[off2 + sz2 - 1] != 0x33) {
+            fprintf(stderr, "[Ckpt] on-device checkpoint recovery failed\n");
+            errs++;
+        } else {
+            printf("[Ckpt] corrupted manifest / torn commit of generation 2 fell back to generation 1\n");
+        }
+    }
+
+    /* 异步接口：写完成回调 + poll/wait + 完成耗时，随后异步读回 */
+    if (errs == 0) {
+        int cb_state = 0;
+        npu_nvme_handle_t *h = npu_nvme_write_async(ctx, write_ptrs, offsets, sizes, 3,
+                                                    async_done_cb, &cb_state);
+        rc = h ? npu_nvme_wait(h, 10000) : -1;
+        if (rc == 0 && (cb_state != 1 || npu_nvme_poll(h) != 0)) rc = -1;
+        /* 耗时记在完成时刻，晚些查询不会变大 */
+        uint64_t el = npu_nvme_handle_elapsed_ns(h);
+        usleep(20000);
+        if (rc == 0 && (el == 0 || npu_nvme_handle_elapsed_ns(h) != el)) rc = -1;
+        npu_nvme_handle_free(h);
+        if (rc == 0) {
+            memset(host_verify, 0, npu_alloc);
+            rc = aclrtMemcpy(npu_buf, npu_alloc, host_verify, npu_alloc,
+                             ACL_MEMCPY_HOST_TO_DEVICE) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc == 0) {
+            h = npu_nvme_read_async(ctx, read_ptrs, offsets, sizes, 3, NULL, NULL);
+            rc = h ? 0 : -1;
+            while (rc == 0 && (rc = npu_nvme_poll(h)) == NPU_NVME_PENDING) rc = 0;
+            npu_nvme_handle_free(h);
+        }
+        if (rc == 0) {
+            rc = aclrtMemcpy(host_verify, npu_alloc, npu_buf, npu_alloc,
+                             ACL_MEMCPY_DEVICE_TO_HOST) == ACL_SUCCESS ? 0 : -1;
+        }
+        if (rc != 0 ||
+            host_verify[off0] != 0x11 || host_verify[off0 + sz0 - 1] != 0x11 ||
+            host_verify[off1] != 0x22 || host_verify[off1 + sz1 - 1] != 0x22 ||
+            host_verify[off2] != 0x33 || host_verify[off2 + sz2 - 1] != 0x33) {
+            fprintf(stderr, "[Async] async write/read round trip failed\n");
+            errs++;
+        } else {
+            printf("[Async] async write/read round trip ok\n");
+        }
+    }
+
+    /* 统计：reset 之后只计入这一对读写，各阶段直方图样本数与命令数一致 */
+    if (errs == 0) {
+        static npu_nvme_stats_t st;
+        npu_nvme_reset_stats(ctx);
+        rc = npu_nvme_write_batch(ctx, write_ptrs, offsets, sizes, 3);
+        if (rc == 0) rc = npu_nvme_read_batch(ctx, read_ptrs, offsets, sizes, 3);
+        if (rc == 0) rc = npu_nvme_get_stats(ctx, &st);
+        const npu_nvme_dir_stats_t *dirs[2] = { &st.write, &st.read };
+        for (int d = 0; rc == 0 && d < 2; d++) {
+            const npu_nvme_dir_stats_t *ds = dirs[d];
+            if (ds->batches != 1 || ds->errors != 0 || ds->commands == 0 ||
+                ds->bytes < sz0 + sz1 + sz2) rc = -1;
+            for (int s = 0; rc == 0 && s < NPU_NVME_NUM_STAGES; s++) {
+                const npu_nvme_hist_t *hh = &ds->hist[s];
+                if (hh->count != ds->commands ||
+                    npu_nvme_hist_percentile(hh, 50) > npu_nvme_hist_percentile(hh, 99) ||
+                    npu_nvme_hist_percentile(hh, 99) > npu_nvme_hist_percentile(hh, 99.9)) rc = -1;
+            }
+        }
+        if (rc != 0 || st.write.bytes != st.read.bytes) {
+            fprintf(stderr, "[Stats] counters or histograms inconsistent\n");
+            errs++;
+        } else {
+            printf("[Stats] write %lu cmds p50/p99 e2e %.1f/%.1f us, nvme %.1f/%.1f us\n",
+                   st.write.commands,
+                   npu_nvme_hist_percentile(&st.write.hist[NPU_NVME_STAGE_E2E], 50) / 1000.0,
+                   npu_nvme_hist_percentile(&st.write.hist[NPU_NVME_STAGE_E2E], 99) / 1000.0,
+                   npu_nvme_hist_percentile(&st.write.hist[NPU_NVME_STAGE_NVME], 50) / 1000.0,
+                   npu_nvme_hist_percentile(&st.write.hist[NPU_NVME_STAGE_NVME], 99) / 1000.0);
+        }
+    }
+
+    /* 小 item 合包：放在前面数据之后 */
+    if (errs == 0) {
+        int bad = test_small_items(ctx, total_span);
+        if (bad != 0) {
+            fprintf(stderr, "[Small] %d small items failed round trip\n", bad);
+            errs++;
+        } else {
+            printf("[Small] %d small items round trip ok\n", SMALL_ITEMS);
+        }
+    }
+
+    /* 大 item 拆分：放在小 item 区域之后 */
+    if (errs == 0) {
+        if (test_large_item(ctx, align_up(total_span, 1 << 20) + (4 << 20)) != 0) {
+            fprintf(stderr, "[Split] item larger than max_transfer failed round trip\n");
+            errs++;
+        } else {
+            printf("[Split] %zu B item split into %zu B commands round trip ok\n",
+                   3 * max_xfer + 12345, max_xfer);
+        }
+    }
+
+    /* 优先级流式读：放在大 item 区域之后、调优 scratch 之前 */
+    if (errs == 0) {
+        double first_ms = 0, total_ms = 0;
+        if (test_stream(ctx, align_up(total_span, 1 << 20) + (48 << 20), &first_ms, &total_ms) != 0) {
+            fprintf(stderr, "[Stream] priority streaming read failed\n");
+            errs++;
+        } else {
+            printf("[Stream] %d items in reverse priority, first ready %.3f ms, all %.3f ms\n",
+                   STREAM_ITEMS, first_ms, total_ms);
+        }
+    }
+
+    /* 张量列表接口：放在流式读区域之后 */
+    if (errs == 0) {
+        if (test_tensors(ctx, align_up(total_span, 1 << 20) + (56 << 20)) != 0) {
+            fprintf(stderr, "[Tensors] tensor list save/load failed\n");
+            errs++;
+        } else {
+            printf("[Tensors] %d tensors laid out, chunked and restored in C ok\n", NUM_TENSORS);
+        }
+    }
+
+    /* 全零检测：tune 与分配方式测试的 scratch 之后 */
+    if (errs == 0) {
+        if (test_zero(ctx, align_up(total_span, 1 << 20) + (80 << 20)) != 0) {
+            fprintf(stderr, "[Zero] zero-chunk detection failed\n");
+            errs++;
+        } else {
+            printf("[Zero] zero chunks skipped on write and read, restored as zeros\n");
+        }
+    }
+
+    /* 快照后排空：放在张量列表区域之后 */
+    if (errs == 0) {
+        if (test_snapshot(ctx, align_up(total_span, 1 << 20) + (60 << 20)) != 0) {
+            fprintf(stderr, "[Snapshot] snapshot-then-drain save failed\n");
+            errs++;
+        } else {
+            printf("[Snapshot] 2 of 3 tensors staged, drained after params changed ok\n");
+        }
+    }
+
+    /* 空间管理：独占 +128MB 之后的一段 */
+    if (errs == 0) {
+        if (test_space(ctx, align_up(total_span, 1 << 20) + (128 << 20)) != 0) {
+            fprintf(stderr, "[Space] extent allocator failed\n");
+            errs++;
+        } else {
+            printf("[Space] versions placed contiguously, retained and reclaimed ok\n");
+        }
+    }
+
+    /* 自动调优：结果在上限之内，调优后（读写切分可能不同）大 item 仍能往返 */
+    npu_nvme_tune_t tune;
+    memset(&tune, 0, sizeof(tune));
+    if (errs == 0) {
+        uint64_t scratch = align_up(total_span, 1 << 20) + (64 << 20);
+        rc = npu_nvme_autotune(ctx, scratch, 8 << 20, 200, &tune);
+        if (rc != 0 ||
+            tune.write_depth < 1 || tune.write_depth > pipeline_depth ||
+            tune.read_depth < 1 || tune.read_depth > pipeline_depth ||
+            tune.write_chunk == 0 || tune.write_chunk > max_xfer ||
+            tune.read_chunk == 0 || tune.read_chunk > max_xfer ||
+            tune.write_mbps <= 0 || tune.read_mbps <= 0 ||
+            test_large_item(ctx, scratch) != 0) {
+            fprintf(stderr, "[Tune] autotune failed\n");
+            errs++;
+        }
     }
 
     /* 清理 */
@@ -200,6 +1325,46 @@ int main(int argc, char **argv) {
     aclrtFree(npu_buf);
     npu_nvme_cleanup(ctx);
 
+    /* 相同配置重新 init 直接套用缓存 */
+    if (errs == 0) {
+        npu_nvme_tune_t cached;
+        ctx = NULL;
+        if (npu_nvme_init_striped(&ctx, addrs, num_devices, stripe_unit, npu_device_id,
+                                  pipeline_depth, req_chunk_size, num_workers, enable_profile) ||
+            npu_nvme_get_tune(ctx, &cached) != 0 ||
+            cached.write_depth != tune.write_depth || cached.write_chunk != tune.write_chunk ||
+            cached.read_depth != tune.read_depth || cached.read_chunk != tune.read_chunk) {
+            fprintf(stderr, "[Tune] cached settings not applied on init\n");
+            errs++;
+        } else {
+            printf("[Tune] write depth=%d chunk=%zu, read depth=%d chunk=%zu restored from cache\n",
+                   cached.write_depth, cached.write_chunk, cached.read_depth, cached.read_chunk);
+        }
+        npu_nvme_cleanup(ctx);
+    }
+    unlink(tune_cache);
+
+    if (errs == 0) {
+        npu_nvme_opts_t o;
+        npu_nvme_opts_init(&o);
+        o.nvme_pci_addrs = addrs;
+        o.num_devices = num_devices;
+        o.stripe_unit = stripe_unit;
+        o.npu_device_id = npu_device_id;
+        o.queue_depth = pipeline_depth;
+        o.chunk_size = req_chunk_size;
+        o.num_workers = num_workers;
+        if (test_dma_policies(&o, align_up(total_span, 1 << 20) + (64 << 20)) != 0) errs++;
+        if (errs == 0 && test_numa(&o, align_up(total_span, 1 << 20) + (64 << 20)) != 0) errs++;
+        if (errs == 0 && test_host_cache(&o, align_up(total_span, 1 << 20) + (96 << 20)) != 0) errs++;
+    }
+
+    if (errs == 0) {
+        printf("\n[Verify] ✓ Data verification passed!\n");
+    } else {
+        printf("\n[Verify] ✗ Data verification failed (mismatches found)\n");
+    }
+
     printf("\n======================================\n");
     printf("Test completed\n");
     printf("======================================\n\n");